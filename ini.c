@@ -23,16 +23,880 @@
 
 #include "ini.h"
 
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-static const char* fmt_spaces = " %256[^=; ] = %256[^\n] ";
-static const char* fmt_no_spaces = " %256[^=; ]=%256[^ \n] ";
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <time.h>
+#endif
+
+// the inihandle and ini_frozen_publish() use GCC's __atomic builtins, which
+// clang has as well
+#ifndef __GNUC__
+#error "ini.c must be built with GCC or clang"
+#endif
+
+#if defined(__GNUC__) && defined(__x86_64__)
+// SSE2 is always there on x86-64, so it needs no runtime check
+#define INI_X86_SIMD
+#include <emmintrin.h>
+#endif
 
 static void freepair_r(struct inipair* root);
+static void* arena_alloc(struct iniarena* arena, size_t size, size_t align);
 static void freesec_r(struct inisection* sec);
 
+// initial number of slots in an index; must be a power of two
+#define INDEX_MIN_CAP 16
+
+// bits for the 'borrowed' field of pairs and sections
+#define BORROWED_NODE (1u << 0) // the structure itself
+#define BORROWED_KEY (1u << 1)  // the key, or the name of a section
+#define BORROWED_VAL (1u << 2)  // the value
+
+// what a pair's parsed value holds, as set by the ini_get_*() functions
+enum valtype {
+  VAL_NONE = 0,
+  VAL_INT64,
+  VAL_DOUBLE,
+  VAL_BOOL,
+  VAL_DURATION,
+  VAL_SIZE,
+};
+
+// set in valtype along with the type when the value couldn't be parsed
+#define VAL_INVALID (1u << 8)
+
+// ini_bind() walks a section rather than looking up each field in it once
+// there's at least one field for this many pairs in the section
+#define BIND_WALK_RATIO 4
+
+// smallest piece of a file loadinifromfile_parallel() will give a thread
+#define PARALLEL_MIN_CHUNK (1024 * 1024)
+
+// usual size of an arena block; larger allocations get their own block
+#define ARENA_BLOCK_SIZE (64 * 1024)
+// alignment of structures allocated from an arena
+#define ARENA_ALIGN (2 * sizeof(void*))
+
+struct iniarenablock {
+  struct iniarenablock* next;
+  size_t used;
+  size_t size;
+  char data[];
+};
+
+struct inimapping {
+  struct inimapping* next;
+  void* addr;
+  size_t len;
+};
+
+// pairs replaced by later ones with the same key, oldest first
+struct inireplaced {
+  struct inipair* head;
+  struct inipair* tail;
+};
+
+/*
+ * A frozen file is one block laid out as a header, the section table, the
+ * pair table and then a pool of NUL-terminated strings. Everything refers to
+ * everything else by offset from the start of the block, so it can live at
+ * any address. Section 0 is the default section; the rest are sorted by name.
+ * Each section's pairs are contiguous in the pair table and sorted by key.
+ */
+
+#define FROZEN_MAGIC "INIFROZ"
+#define FROZEN_VERSION 1
+// offset used for a value which is NULL
+#define FROZEN_NULL UINT32_MAX
+
+struct frozenheader {
+  char magic[8];
+  uint32_t version;
+  uint32_t nsections;
+  uint32_t npairs;
+  uint32_t sections;
+  uint32_t pairs;
+  uint32_t strings;
+  uint64_t size;
+};
+
+struct frozensection {
+  uint32_t name;
+  uint32_t namelen;
+  uint32_t first;
+  uint32_t npairs;
+};
+
+struct frozenpair {
+  uint32_t key;
+  uint32_t keylen;
+  uint32_t val;
+  uint32_t vallen;
+};
+
+// how a frozen file's block was made, and so how it's released
+enum frozenkind {
+  FROZEN_HEAP,
+  FROZEN_MAPPED,
+};
+
+struct inifrozen {
+  const char* base;
+  size_t size;
+  enum frozenkind kind;
+};
+
+// whitespace within a line
+#define ISSPACE(c) \
+  ((c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == '\v' || (c) == '\f')
+
+// kinds of lines, as classified by lexline()
+enum linekind {
+  LINE_BLANK,
+  LINE_COMMENT,
+  LINE_SECTION,
+  LINE_PAIR,
+  // a key without a value
+  LINE_KEY,
+  LINE_INVALID,
+};
+
+// a line as split up by lexline()
+struct initoken {
+  enum linekind kind;
+  // key, or name for sections
+  char* key;
+  size_t keylen;
+  char* val;
+  size_t vallen;
+};
+
+/*
+ * State for parsing, either into a file or out to a callback.
+ * This is what's behind the incremental parser in ini.h, and is also
+ * used on the stack by everything else which parses.
+ */
+struct iniparser {
+  // file being loaded, or NULL to only call cb
+  struct inifile* ini;
+  // called with each pair, if not NULL
+  ini_pair_op cb;
+  // called with each section and pair when there is no file, if not NULL
+  ini_pair_op_ex cbex;
+  void* userdata;
+  // nonzero once cbex has asked to stop, and what it returned
+  int stopped;
+  int flags;
+  // current section; with no file, this is cbsec
+  struct inisection* sec;
+  // section handed to cb with no file, named by secname
+  struct inisection cbsec;
+  char* secname;
+  size_t secnamecap;
+  // line being put together from pieces, or copied to be written to
+  char* line;
+  size_t linelen;
+  size_t linecap;
+};
+
+// returns whether an index item is named by the first len characters of name
+typedef int (*index_match)(const void* item, const char* name, size_t len);
+
+// FNV-1a over the first len characters of str
+static unsigned long strhash(const char* str, size_t len) {
+  unsigned long h = 2166136261UL;
+  for (const unsigned char* c = (const unsigned char*)str; len--; c++) {
+    h ^= *c;
+    h *= 16777619UL;
+  }
+  return h;
+}
+
+// interned names can be matched by pointer without looking at them
+
+static int section_match(const void* item, const char* name, size_t len) {
+  const struct inisection* s = item;
+  return s->namelen == len
+         && (s->name == name || 0 == memcmp(s->name, name, len));
+}
+
+static int pair_match(const void* item, const char* name, size_t len) {
+  const struct inipair* p = item;
+  return p->keylen == len
+         && (p->key == name || 0 == memcmp(p->key, name, len));
+}
+
+static int string_match(const void* item, const char* name, size_t len) {
+  const char* s = item;
+  return s == name || (0 == strncmp(s, name, len) && s[len] == '\0');
+}
+
+/*
+ * Finds the slot holding the item named by the first len characters of name,
+ * or NULL if there isn't one.
+ */
+static struct inislot* index_lookup(struct iniindex* idx, const char* name,
+                                    size_t len, unsigned long hash,
+                                    index_match match) {
+  if (idx->cap == 0) {
+    return NULL;
+  }
+
+  size_t mask = idx->cap - 1;
+  for (size_t i = hash & mask; idx->slots[i].item; i = (i + 1) & mask) {
+    if (idx->slots[i].hash == hash && match(idx->slots[i].item, name, len)) {
+      return &idx->slots[i];
+    }
+  }
+
+  return NULL;
+}
+
+// places an item in the first free slot, the index must have room for it
+static void index_place(struct inislot* slots, size_t cap, void* item,
+                        unsigned long hash) {
+  size_t mask = cap - 1;
+  size_t i = hash & mask;
+  while (slots[i].item) {
+    i = (i + 1) & mask;
+  }
+  slots[i].hash = hash;
+  slots[i].item = item;
+}
+
+/*
+ * Makes sure one more item can be added to the index without going over
+ * a 3/4 load factor. Any new slots come from arena, or from malloc if it's
+ * NULL. Returns 0 on success, else 1.
+ */
+static int index_reserve(struct iniindex* idx, struct iniarena* arena) {
+  if ((idx->count + 1) * 4 <= idx->cap * 3) {
+    return 0;
+  }
+
+  size_t cap = idx->cap ? idx->cap * 2 : INDEX_MIN_CAP;
+  struct inislot* slots;
+  if (arena != NULL) {
+    slots = arena_alloc(arena, cap * sizeof(struct inislot), ARENA_ALIGN);
+    if (slots != NULL) {
+      memset(slots, 0, cap * sizeof(struct inislot));
+    }
+  } else {
+    slots = calloc(cap, sizeof(struct inislot));
+    if (slots == NULL) {
+      perror("index_reserve: calloc");
+    }
+  }
+  if (slots == NULL) {
+    return 1;
+  }
+
+  for (size_t i = 0; i < idx->cap; i++) {
+    if (idx->slots[i].item) {
+      index_place(slots, cap, idx->slots[i].item, idx->slots[i].hash);
+    }
+  }
+
+  // slots from an arena go when it does
+  if (!idx->arena) {
+    free(idx->slots);
+  }
+  idx->slots = slots;
+  idx->cap = cap;
+  idx->arena = arena != NULL;
+  return 0;
+}
+
+/*
+ * Adds an item which is not already in the index.
+ * index_reserve() must have been called first.
+ */
+static void index_add(struct iniindex* idx, void* item, unsigned long hash) {
+  index_place(idx->slots, idx->cap, item, hash);
+  idx->count++;
+}
+
+/*
+ * Removes the item in the given slot, shifting any items after it which
+ * would no longer be found back into the gap.
+ */
+static void index_remove(struct iniindex* idx, struct inislot* slot) {
+  size_t mask = idx->cap - 1;
+  size_t hole = slot - idx->slots;
+  for (size_t i = (hole + 1) & mask; idx->slots[i].item; i = (i + 1) & mask) {
+    // an item can fill the hole unless its home slot is after the hole, up
+    // to where it is now
+    size_t home = idx->slots[i].hash & mask;
+    int stays = hole <= i ? hole < home && home <= i
+                          : hole < home || home <= i;
+    if (!stays) {
+      idx->slots[hole] = idx->slots[i];
+      hole = i;
+    }
+  }
+  idx->slots[hole].item = NULL;
+  idx->slots[hole].hash = 0;
+  idx->count--;
+}
+
+static void index_free(struct iniindex* idx) {
+  if (!idx->arena) {
+    free(idx->slots);
+  }
+  idx->slots = NULL;
+  idx->cap = 0;
+  idx->count = 0;
+}
+
+/*
+ * Sections and pairs are kept in sorted lists. While names show up in order,
+ * each one is just appended, but the first time one doesn't, a treap is
+ * built over the list so that finding where anything goes takes O(log n)
+ * rather than a walk. The treap is a binary search tree by name which is also
+ * a heap by a priority taken from the name's hash, so its shape depends only
+ * on what's in it. The order_*() functions work on either kind of item, given
+ * where the item keeps its links, name and hash.
+ */
+struct iniorder {
+  size_t next;
+  size_t name;
+  size_t hash;
+  size_t left;
+  size_t right;
+};
+
+static const struct iniorder pair_order = {
+  offsetof(struct inipair, next),
+  offsetof(struct inipair, key),
+  offsetof(struct inipair, hash),
+  offsetof(struct inipair, left),
+  offsetof(struct inipair, right),
+};
+
+static const struct iniorder section_order = {
+  offsetof(struct inisection, next),
+  offsetof(struct inisection, name),
+  offsetof(struct inisection, hash),
+  offsetof(struct inisection, left),
+  offsetof(struct inisection, right),
+};
+
+#define ORDER_LINK(item, offset) ((void**)((char*)(item) + (offset)))
+#define ORDER_NAME(o, item) (*(char**)((char*)(item) + (o)->name))
+
+// the treap priority of an item, mixed so that similar names spread out
+static unsigned long order_priority(const struct iniorder* o, void* item) {
+  unsigned long h = *(unsigned long*)((char*)item + o->hash);
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdUL;
+  h ^= h >> 33;
+  return h;
+}
+
+/*
+ * Builds a treap over a sorted list in O(n), keeping the right spine of the
+ * tree so far as a stack whose right links point back up while it's built.
+ */
+static void* order_build(const struct iniorder* o, void* head) {
+  void* top = NULL;
+  for (void* item = head; item; item = *ORDER_LINK(item, o->next)) {
+    unsigned long prio = order_priority(o, item);
+    void* last = NULL;
+    while (top != NULL && order_priority(o, top) < prio) {
+      void* up = *ORDER_LINK(top, o->right);
+      *ORDER_LINK(top, o->right) = last;
+      last = top;
+      top = up;
+    }
+    *ORDER_LINK(item, o->left) = last;
+    *ORDER_LINK(item, o->right) = top;
+    top = item;
+  }
+
+  // point the spine's right links back down
+  void* last = NULL;
+  while (top != NULL) {
+    void* up = *ORDER_LINK(top, o->right);
+    *ORDER_LINK(top, o->right) = last;
+    last = top;
+    top = up;
+  }
+  return last;
+}
+
+// finds the last item in the tree whose name comes before the given one
+static void* order_prev(const struct iniorder* o, void* root,
+                        const char* name) {
+  void* prev = NULL;
+  while (root != NULL) {
+    if (strcmp(name, ORDER_NAME(o, root)) > 0) {
+      prev = root;
+      root = *ORDER_LINK(root, o->right);
+    } else {
+      root = *ORDER_LINK(root, o->left);
+    }
+  }
+  return prev;
+}
+
+// finds the link in the tree which points to an item in it
+static void** order_find(const struct iniorder* o, void** link, void* item) {
+  const char* name = ORDER_NAME(o, item);
+  while (*link != item) {
+    int cmp = strcmp(name, ORDER_NAME(o, *link));
+    link = ORDER_LINK(*link, cmp < 0 ? o->left : o->right);
+  }
+  return link;
+}
+
+// adds an item whose name isn't in the tree yet
+static void order_insert(const struct iniorder* o, void** link, void* item) {
+  unsigned long prio = order_priority(o, item);
+  while (*link != NULL && order_priority(o, *link) >= prio) {
+    int cmp = strcmp(ORDER_NAME(o, item), ORDER_NAME(o, *link));
+    link = ORDER_LINK(*link, cmp < 0 ? o->left : o->right);
+  }
+
+  // the item takes this spot, and what was there is split around it
+  void* n = *link;
+  *link = item;
+  void** l = ORDER_LINK(item, o->left);
+  void** r = ORDER_LINK(item, o->right);
+  while (n != NULL) {
+    if (strcmp(ORDER_NAME(o, n), ORDER_NAME(o, item)) < 0) {
+      *l = n;
+      l = ORDER_LINK(n, o->right);
+      n = *l;
+    } else {
+      *r = n;
+      r = ORDER_LINK(n, o->left);
+      n = *r;
+    }
+  }
+  *l = NULL;
+  *r = NULL;
+}
+
+// takes an item out of the tree, merging its children into its spot
+static void order_remove(const struct iniorder* o, void** root, void* item) {
+  void** link = order_find(o, root, item);
+  void* a = *ORDER_LINK(item, o->left);
+  void* b = *ORDER_LINK(item, o->right);
+  while (a != NULL && b != NULL) {
+    if (order_priority(o, a) >= order_priority(o, b)) {
+      *link = a;
+      link = ORDER_LINK(a, o->right);
+      a = *link;
+    } else {
+      *link = b;
+      link = ORDER_LINK(b, o->left);
+      b = *link;
+    }
+  }
+  *link = a != NULL ? a : b;
+}
+
+// puts an item in the place of one with the same name, and so priority
+static void order_replace(const struct iniorder* o, void** root, void* old,
+                          void* item) {
+  *order_find(o, root, old) = item;
+  *ORDER_LINK(item, o->left) = *ORDER_LINK(old, o->left);
+  *ORDER_LINK(item, o->right) = *ORDER_LINK(old, o->right);
+}
+
+/*
+ * Allocates size bytes aligned to align (a power of two) from an arena.
+ * The memory is not zeroed. Returns NULL on error.
+ */
+static void* arena_alloc(struct iniarena* arena, size_t size, size_t align) {
+  struct iniarenablock* b = arena->blocks;
+  size_t pad = 0;
+  if (b != NULL) {
+    pad = -(uintptr_t)(b->data + b->used) & (align - 1);
+  }
+
+  if (b == NULL || b->size - b->used < pad + size) {
+    size_t bsize = size + align > ARENA_BLOCK_SIZE ? size + align
+                                                   : ARENA_BLOCK_SIZE;
+    b = malloc(sizeof(struct iniarenablock) + bsize);
+    if (b == NULL) {
+      perror("arena_alloc: malloc");
+      return NULL;
+    }
+    b->used = 0;
+    b->size = bsize;
+    b->next = arena->blocks;
+    arena->blocks = b;
+    pad = -(uintptr_t)b->data & (align - 1);
+  }
+
+  void* mem = b->data + b->used + pad;
+  b->used += pad + size;
+  return mem;
+}
+
+// like strndup(), but from an arena
+static char* arena_strndup(struct iniarena* arena, const char* str,
+                           size_t len) {
+  char* s = arena_alloc(arena, len + 1, 1);
+  if (s != NULL) {
+    memcpy(s, str, len);
+    s[len] = '\0';
+  }
+  return s;
+}
+
+static void arena_free(struct iniarena* arena) {
+  struct iniarenablock* b = arena->blocks;
+  while (b != NULL) {
+    struct iniarenablock* next = b->next;
+    free(b);
+    b = next;
+  }
+  arena->blocks = NULL;
+}
+
+/*
+ * Moves every block of src into dst, leaving src empty. The blocks go after
+ * dst's current one, which is the only one arena_alloc() still uses.
+ */
+static void arena_splice(struct iniarena* dst, struct iniarena* src) {
+  if (src->blocks == NULL) {
+    return;
+  }
+
+  struct iniarenablock* last = src->blocks;
+  while (last->next != NULL) {
+    last = last->next;
+  }
+
+  if (dst->blocks == NULL) {
+    dst->blocks = src->blocks;
+  } else {
+    last->next = dst->blocks->next;
+    dst->blocks->next = src->blocks;
+  }
+  src->blocks = NULL;
+}
+
+// the arena a file's indexes come from, or NULL if they come from malloc
+static struct iniarena* file_arena(struct inifile* ini) {
+  return ini != NULL && (ini->flags & INIO_ARENA) ? &ini->arena : NULL;
+}
+
+// allocates a zeroed pair or section for the given file
+static void* ini_callocnode(struct inifile* ini, size_t size) {
+  void* node;
+  if (ini->flags & INIO_ARENA) {
+    node = arena_alloc(&ini->arena, size, ARENA_ALIGN);
+    if (node != NULL) {
+      memset(node, 0, size);
+    }
+  } else {
+    node = calloc(1, size);
+    if (node == NULL) {
+      perror("ini_callocnode: calloc");
+    }
+  }
+  return node;
+}
+
+/*
+ * Gets a copy of the first len characters of str for use in the given file,
+ * from its arena if it has one. If borrow is set, str is instead terminated
+ * in place and returned as-is. Any memory which must not be freed is marked
+ * in *borrowed with the given bit.
+ */
+static char* ini_strndup(struct inifile* ini, char* str, size_t len,
+                         int borrow, unsigned int* borrowed,
+                         unsigned int bit) {
+  if (borrow) {
+    str[len] = '\0';
+    *borrowed |= bit;
+    return str;
+  }
+
+  if (ini->flags & INIO_ARENA) {
+    *borrowed |= bit;
+    return arena_strndup(&ini->arena, str, len);
+  }
+
+  return strndup(str, len);
+}
+
+/*
+ * Gets the interned copy of the first len characters of str in the given
+ * file. Interned strings always come from the file's arena, whether or not
+ * it uses INIO_ARENA. Returns NULL on error.
+ */
+static char* ini_internn(struct inifile* ini, const char* str, size_t len) {
+  unsigned long hash = strhash(str, len);
+  struct inislot* slot = index_lookup(&ini->strings, str, len, hash,
+                                      string_match);
+  if (slot != NULL) {
+    return slot->item;
+  }
+
+  if (index_reserve(&ini->strings, file_arena(ini))) {
+    return NULL;
+  }
+  char* copy = arena_strndup(&ini->arena, str, len);
+  if (copy != NULL) {
+    index_add(&ini->strings, copy, hash);
+  }
+  return copy;
+}
+
+/*
+ * Like ini_strndup(), but for keys and section names, which are interned
+ * rather than copied if the file uses INIO_INTERN.
+ */
+static char* ini_namedup(struct inifile* ini, char* str, size_t len,
+                         int borrow, unsigned int* borrowed) {
+  if (ini->flags & INIO_INTERN) {
+    *borrowed |= BORROWED_KEY;
+    return ini_internn(ini, str, len);
+  }
+  return ini_strndup(ini, str, len, borrow, borrowed, BORROWED_KEY);
+}
+
+/*
+ * Makes a section named by the first len characters of name for use in
+ * the given file. See ini_strndup() for the meaning of borrow.
+ */
+static struct inisection* ini_makesection(struct inifile* ini, char* name,
+                                          size_t len, int borrow) {
+  struct inisection* s = ini_callocnode(ini, sizeof(struct inisection));
+  if (s == NULL) {
+    return NULL;
+  }
+  if (ini->flags & INIO_ARENA) {
+    s->borrowed = BORROWED_NODE;
+  }
+
+  s->name = ini_namedup(ini, name, len, borrow, &s->borrowed);
+  if (s->name == NULL) {
+    freesection(s);
+    return NULL;
+  }
+  return s;
+}
+
+/*
+ * Makes a pair from the first keylen characters of key and vallen characters
+ * of val (which may be NULL) for use in the given file. See ini_strndup() for
+ * the meaning of borrow.
+ */
+static struct inipair* ini_makepair(struct inifile* ini, char* key,
+                                    size_t keylen, char* val, size_t vallen,
+                                    int borrow) {
+  struct inipair* p = ini_callocnode(ini, sizeof(struct inipair));
+  if (p == NULL) {
+    return NULL;
+  }
+  if (ini->flags & INIO_ARENA) {
+    p->borrowed = BORROWED_NODE;
+  }
+
+  p->key = ini_namedup(ini, key, keylen, borrow, &p->borrowed);
+  if (val != NULL) {
+    p->val = ini_strndup(ini, val, vallen, borrow, &p->borrowed,
+                         BORROWED_VAL);
+  }
+
+  if (p->key == NULL || (val != NULL && p->val == NULL)) {
+    freepair(p);
+    return NULL;
+  }
+  return p;
+}
+
+/*
+ * Subscriptions are grouped by section, each of which has one index of
+ * subscribed keys and one of subscribed prefixes, so that a change only
+ * looks at subscriptions for its own key. Prefixes are found by looking up
+ * the key's leading characters at each length any prefix in the section has.
+ */
+
+// subscriptions to a key, or to keys starting with a prefix
+struct inisubkey {
+  char* key;
+  size_t keylen;
+  struct inisub* subs;
+};
+
+struct inisub {
+  struct inisub* next;
+  struct inisubkey* owner;
+  struct inisubsection* section;
+  int prefix;
+  ini_change_op cb;
+  void* userdata;
+};
+
+struct inisubsection {
+  // NULL for the default section
+  char* name;
+  size_t namelen;
+  struct iniindex keys;
+  struct iniindex prefixes;
+  // lengths of the prefixes in use, ascending, and how many subscriptions
+  // have a prefix of each length
+  size_t* prefixlens;
+  size_t* prefixrefs;
+  size_t nprefixlens;
+  // how many changes are being reported to the section at the moment, and
+  // whether any prefix lengths fell out of use while they were, in which
+  // case they're dropped once it's done
+  int dispatching;
+  int stale;
+};
+
+struct inisubs {
+  struct inisubsection* default_section;
+  struct iniindex sections;
+};
+
+static int subkey_match(const void* item, const char* name, size_t len) {
+  const struct inisubkey* k = item;
+  return k->keylen == len && 0 == memcmp(k->key, name, len);
+}
+
+static int subsection_match(const void* item, const char* name, size_t len) {
+  const struct inisubsection* s = item;
+  return s->namelen == len && 0 == memcmp(s->name, name, len);
+}
+
+// drops the prefix lengths which no subscriptions use any more
+static void subsection_compact(struct inisubsection* ss) {
+  size_t n = 0;
+  for (size_t i = 0; i < ss->nprefixlens; i++) {
+    if (ss->prefixrefs[i] != 0) {
+      ss->prefixlens[n] = ss->prefixlens[i];
+      ss->prefixrefs[n] = ss->prefixrefs[i];
+      n++;
+    }
+  }
+  ss->nprefixlens = n;
+  ss->stale = 0;
+}
+
+// calls the subscriptions to one key or prefix
+static void subs_call(struct inislot* slot, struct inisection* sec,
+                      struct inipair* pair, enum INI_CHANGE kind) {
+  if (slot == NULL) {
+    return;
+  }
+  struct inisubkey* k = slot->item;
+  for (struct inisub* sub = k->subs, *next; sub; sub = next) {
+    // callbacks may unsubscribe themselves
+    next = sub->next;
+    sub->cb(sec, pair, kind, sub->userdata);
+  }
+}
+
+// reports a change to a pair in a section to anything subscribed to it
+static void subs_notify(struct inisection* sec, struct inipair* pair,
+                        enum INI_CHANGE kind) {
+  if (sec->file == NULL || sec->file->subs == NULL) {
+    return;
+  }
+
+  struct inisubs* subs = sec->file->subs;
+  struct inisubsection* ss = subs->default_section;
+  if (sec->name != NULL) {
+    struct inislot* slot = index_lookup(&subs->sections, sec->name,
+                                        sec->namelen, sec->hash,
+                                        subsection_match);
+    ss = slot == NULL ? NULL : slot->item;
+  }
+  if (ss == NULL) {
+    return;
+  }
+
+  // callbacks which unsubscribe can't change the prefix lengths under the
+  // loop below
+  ss->dispatching++;
+  subs_call(index_lookup(&ss->keys, pair->key, pair->keylen, pair->hash,
+                         subkey_match), sec, pair, kind);
+
+  // strhash() is FNV-1a, so each prefix's hash carries on from the last
+  unsigned long h = strhash(pair->key, 0);
+  size_t hashed = 0;
+  for (size_t i = 0; i < ss->nprefixlens; i++) {
+    size_t len = ss->prefixlens[i];
+    if (len > pair->keylen) {
+      break;
+    }
+    for (; hashed < len; hashed++) {
+      h ^= (unsigned char)pair->key[hashed];
+      h *= 16777619UL;
+    }
+    subs_call(index_lookup(&ss->prefixes, pair->key, len, h, subkey_match),
+              sec, pair, kind);
+  }
+  if (--ss->dispatching == 0 && ss->stale) {
+    subsection_compact(ss);
+  }
+}
+
+static void subsection_free(struct inisubsection* ss) {
+  if (ss == NULL) {
+    return;
+  }
+
+  struct iniindex* idxs[] = {&ss->keys, &ss->prefixes};
+  for (size_t i = 0; i < 2; i++) {
+    for (size_t j = 0; j < idxs[i]->cap; j++) {
+      struct inisubkey* k = idxs[i]->slots[j].item;
+      if (k == NULL) {
+        continue;
+      }
+      while (k->subs != NULL) {
+        struct inisub* next = k->subs->next;
+        free(k->subs);
+        k->subs = next;
+      }
+      free(k->key);
+      free(k);
+    }
+    index_free(idxs[i]);
+  }
+  free(ss->prefixlens);
+  free(ss->prefixrefs);
+  free(ss->name);
+  free(ss);
+}
+
+static void subs_free(struct inisubs* subs) {
+  if (subs == NULL) {
+    return;
+  }
+
+  subsection_free(subs->default_section);
+  for (size_t i = 0; i < subs->sections.cap; i++) {
+    subsection_free(subs->sections.slots[i].item);
+  }
+  index_free(&subs->sections);
+  free(subs);
+}
+
 struct inisection* makesection(char* name) {
   if (name == NULL) {
     return NULL;
@@ -45,6 +909,7 @@ struct inisection* makesection(char* name) {
   s->name = strdup(name);
   s->head = NULL;
   s->next = NULL;
+  s->tail = NULL;
   return s;
 }
 
@@ -55,6 +920,7 @@ struct inifile* makeini(int flags) {
     return NULL;
   }
   f->head = NULL;
+  f->tail = NULL;
   f->default_section = calloc(1, sizeof(struct inisection));
   if (f->default_section == NULL) {
     perror("makeini: calloc");
@@ -64,6 +930,8 @@ struct inifile* makeini(int flags) {
   f->default_section->name = NULL;
   f->default_section->head = NULL;
   f->default_section->next = NULL;
+  f->default_section->tail = NULL;
+  f->default_section->file = f;
   f->flags = flags;
   return f;
 }
@@ -71,10 +939,15 @@ struct inifile* makeini(int flags) {
 struct inisection* freesection(struct inisection* sec) {
   if (sec != NULL) {
     freepair_r(sec->head);
+    index_free(&sec->pairs);
     struct inisection* next = sec->next;
-    // names are created with strdup
-    free(sec->name);
-    free(sec);
+    // names are created with strdup, unless they're borrowed
+    if (!(sec->borrowed & BORROWED_KEY)) {
+      free(sec->name);
+    }
+    if (!(sec->borrowed & BORROWED_NODE)) {
+      free(sec);
+    }
     return next;
   }
   return NULL;
@@ -98,10 +971,16 @@ struct inipair* makepair(char* key, char* val) {
 struct inipair* freepair(struct inipair* pair) {
   if (pair != NULL) {
     struct inipair* next = pair->next;
-    // keys/vals are created with strdup
-    free(pair->key);
-    free(pair->val);
-    free(pair);
+    // keys/vals are created with strdup, unless they're borrowed
+    if (!(pair->borrowed & BORROWED_KEY)) {
+      free(pair->key);
+    }
+    if (!(pair->borrowed & BORROWED_VAL)) {
+      free(pair->val);
+    }
+    if (!(pair->borrowed & BORROWED_NODE)) {
+      free(pair);
+    }
     return next;
   }
   return NULL;
@@ -120,352 +999,3844 @@ void freesec_r(struct inisection* sec) {
     return;
   }
 
-  while ((sec = freesection(sec)));
+  while ((sec = freesection(sec)));
+}
+
+void freeini(struct inifile* ini) {
+  if (ini == NULL) {
+    return;
+  }
+
+  if (ini->heapowned) {
+    freesec_r(ini->default_section);
+    freesec_r(ini->head);
+  } else {
+    // everything but the default section itself goes with the arena
+    index_free(&ini->default_section->pairs);
+    free(ini->default_section);
+  }
+  index_free(&ini->sections);
+  index_free(&ini->strings);
+  subs_free(ini->subs);
+  if (ini->replaced != NULL) {
+    freepair_r(ini->replaced->head);
+    free(ini->replaced);
+  }
+  arena_free(&ini->arena);
+  while (ini->mappings != NULL) {
+    struct inimapping* next = ini->mappings->next;
+    munmap(ini->mappings->addr, ini->mappings->len);
+    free(ini->mappings);
+    ini->mappings = next;
+  }
+  free(ini);
+}
+
+// whether nothing in a pair came from malloc
+static int pair_borrowed(const struct inipair* pair) {
+  unsigned int all = BORROWED_NODE | BORROWED_KEY;
+  if (pair->val != NULL) {
+    all |= BORROWED_VAL;
+  }
+  return (pair->borrowed & all) == all;
+}
+
+/*
+ * Whether nothing in a section, apart from its pairs, came from malloc.
+ * Pairs are checked as they're linked into a file, and an index from malloc
+ * means pairs were added before the section was in one.
+ */
+static int section_borrowed(const struct inisection* sec) {
+  unsigned int all = BORROWED_NODE | BORROWED_KEY;
+  return (sec->borrowed & all) == all
+         && (sec->pairs.cap == 0 || sec->pairs.arena);
+}
+
+/*
+ * Links a section into a file's list after prev (or at the head if prev is
+ * NULL) and adds it to the file's index. The section's hash and namelen must
+ * be set, and index_reserve() must have been called.
+ */
+static void section_link(struct inifile* file, struct inisection* prev,
+                         struct inisection* sec) {
+  struct inisection** link = prev == NULL ? &file->head : &prev->next;
+  sec->next = *link;
+  sec->file = file;
+  if (!section_borrowed(sec)) {
+    file->heapowned = 1;
+  }
+  *link = sec;
+  if (sec->next == NULL) {
+    file->tail = sec;
+  }
+  index_add(&file->sections, sec, sec->hash);
+  if (file->root != NULL) {
+    order_insert(&section_order, (void**)&file->root, sec);
+  }
+  file->generation++;
+}
+
+/*
+ * Removes a section from a file's list and index without freeing it.
+ * prev must be the section before it, or NULL if it's the head.
+ */
+static void section_unlink(struct inifile* file, struct inisection* prev,
+                           struct inisection* sec) {
+  *(prev == NULL ? &file->head : &prev->next) = sec->next;
+  if (file->tail == sec) {
+    file->tail = prev;
+  }
+  index_remove(&file->sections,
+               index_lookup(&file->sections, sec->name, sec->namelen,
+                            sec->hash, section_match));
+  if (file->root != NULL) {
+    order_remove(&section_order, (void**)&file->root, sec);
+  }
+  file->generation++;
+}
+
+// like section_link(), but for pairs in a section
+static void pair_link(struct inisection* sec, struct inipair* prev,
+                      struct inipair* pair) {
+  struct inipair** link = prev == NULL ? &sec->head : &prev->next;
+  pair->next = *link;
+  pair->section = sec;
+  if (sec->file != NULL && !pair_borrowed(pair)) {
+    sec->file->heapowned = 1;
+  }
+  *link = pair;
+  if (pair->next == NULL) {
+    sec->tail = pair;
+  }
+  index_add(&sec->pairs, pair, pair->hash);
+  if (sec->root != NULL) {
+    order_insert(&pair_order, (void**)&sec->root, pair);
+  }
+  sec->generation++;
+  subs_notify(sec, pair, INIC_ADDED);
+}
+
+// like section_unlink(), but for pairs in a section
+static void pair_unlink(struct inisection* sec, struct inipair* prev,
+                        struct inipair* pair) {
+  subs_notify(sec, pair, INIC_REMOVED);
+  *(prev == NULL ? &sec->head : &prev->next) = pair->next;
+  if (sec->tail == pair) {
+    sec->tail = prev;
+  }
+  index_remove(&sec->pairs,
+               index_lookup(&sec->pairs, pair->key, pair->keylen, pair->hash,
+                            pair_match));
+  if (sec->root != NULL) {
+    order_remove(&pair_order, (void**)&sec->root, pair);
+  }
+  sec->generation++;
+}
+
+struct inisection* section_insert(struct inifile* file, struct inisection* sec) {
+  if (file == NULL || sec == NULL) {
+    return NULL;
+  }
+
+  sec->namelen = strlen(sec->name);
+  sec->hash = strhash(sec->name, sec->namelen);
+  struct inislot* slot = index_lookup(&file->sections, sec->name,
+                                      sec->namelen, sec->hash, section_match);
+  if (slot != NULL) {
+    return slot->item;
+  }
+
+  if (index_reserve(&file->sections, file_arena(file))) {
+    return NULL;
+  }
+
+  struct inisection* prev = NULL;
+  if (file->head != NULL) {
+    if (strcmp(sec->name, file->tail->name) > 0) {
+      // sections usually show up in order, so check the end first
+      prev = file->tail;
+    } else {
+      if (file->root == NULL) {
+        file->root = order_build(&section_order, file->head);
+      }
+      prev = order_prev(&section_order, file->root, sec->name);
+    }
+  }
+
+  section_link(file, prev, sec);
+  return sec;
+}
+
+struct inipair* pair_insert(struct inisection* sec, struct inipair* pair) {
+  if (sec == NULL || pair == NULL) {
+    return NULL;
+  }
+
+  pair->keylen = strlen(pair->key);
+  pair->hash = strhash(pair->key, pair->keylen);
+  struct inislot* slot = index_lookup(&sec->pairs, pair->key, pair->keylen,
+                                      pair->hash, pair_match);
+  if (slot != NULL) { // equal to (overwrite)
+    struct inipair* curr = slot->item;
+    struct inipair* prev = NULL;
+    if (curr != sec->head) {
+      if (sec->root == NULL) {
+        sec->root = order_build(&pair_order, sec->head);
+      }
+      prev = order_prev(&pair_order, sec->root, curr->key);
+    }
+    if (sec->root != NULL) {
+      order_replace(&pair_order, (void**)&sec->root, curr, pair);
+    }
+
+    if (prev == NULL) {
+      sec->head = pair;
+    } else {
+      prev->next = pair;
+    }
+    pair->next = curr->next;
+    if (sec->tail == curr) {
+      sec->tail = pair;
+    }
+    slot->item = pair;
+    pair->section = sec;
+    if (sec->file != NULL && !pair_borrowed(pair)) {
+      sec->file->heapowned = 1;
+    }
+    sec->generation++;
+    if (sec->file != NULL && sec->file->replaced != NULL) {
+      // kept, along with the section it was in, to be reported later
+      struct inireplaced* r = sec->file->replaced;
+      curr->next = NULL;
+      *(r->head == NULL ? &r->head : &r->tail->next) = curr;
+      r->tail = curr;
+    } else {
+      freepair(curr);
+    }
+    subs_notify(sec, pair, INIC_CHANGED);
+    return pair;
+  }
+
+  if (index_reserve(&sec->pairs, file_arena(sec->file))) {
+    return NULL;
+  }
+
+  struct inipair* prev = NULL;
+  if (sec->head != NULL) {
+    if (strcmp(pair->key, sec->tail->key) > 0) {
+      // keys usually show up in order, so check the end first
+      prev = sec->tail;
+    } else {
+      if (sec->root == NULL) {
+        sec->root = order_build(&pair_order, sec->head);
+      }
+      prev = order_prev(&pair_order, sec->root, pair->key);
+    }
+  }
+
+  pair_link(sec, prev, pair);
+  return pair;
+}
+
+/*
+ * Inserts a section made for the file, which is freed if it can't be
+ * inserted or the file already has one by that name. Returns whichever
+ * section the file ends up with, or NULL on error.
+ */
+static struct inisection* section_insertnew(struct inifile* file,
+                                            struct inisection* sec) {
+  struct inisection* s = section_insert(file, sec);
+  if (s != sec) {
+    freesection(sec);
+  }
+  return s;
+}
+
+// like section_insertnew(), but for pairs, which always replace any other
+static struct inipair* pair_insertnew(struct inisection* sec,
+                                      struct inipair* pair) {
+  if (pair_insert(sec, pair) == NULL) {
+    freepair(pair);
+    return NULL;
+  }
+  return pair;
+}
+
+// finds the section named by the first len characters of name
+static struct inisection* getsection_n(struct inifile* ini, const char* name,
+                                       size_t len, unsigned long hash) {
+  struct inislot* slot = index_lookup(&ini->sections, name, len, hash,
+                                      section_match);
+  return slot == NULL ? NULL : slot->item;
+}
+
+// finds the pair keyed by the first len characters of key
+static struct inipair* getpair_n(struct inisection* section, const char* key,
+                                 size_t len, unsigned long hash) {
+  struct inislot* slot = index_lookup(&section->pairs, key, len, hash,
+                                      pair_match);
+  return slot == NULL ? NULL : slot->item;
+}
+
+/*
+ * The scankey_*() functions return the first character in [p, end) which is
+ * '=', ';' or at most ' ', or end if there isn't one. Everything which can
+ * end a key is in that set, along with some control characters which
+ * findkeyend() filters back out.
+ */
+
+static char* scankey_scalar(char* p, char* end) {
+  while (p < end && *p != '=' && *p != ';' && (unsigned char)*p > ' ') {
+    p++;
+  }
+  return p;
+}
+
+#ifdef INI_X86_SIMD
+static char* scankey_sse2(char* p, char* end) {
+  const __m128i eq = _mm_set1_epi8('=');
+  const __m128i semi = _mm_set1_epi8(';');
+  const __m128i space = _mm_set1_epi8(' ');
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    __m128i m = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, eq), _mm_cmpeq_epi8(v, semi)),
+        _mm_cmpeq_epi8(_mm_min_epu8(v, space), v));
+    int mask = _mm_movemask_epi8(m);
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+  return scankey_scalar(p, end);
+}
+#endif
+
+// finds the end of the key starting at p, in [p, end)
+static char* findkeyend(char* p, char* end) {
+  for (;;) {
+#ifdef INI_X86_SIMD
+    p = scankey_sse2(p, end);
+#else
+    p = scankey_scalar(p, end);
+#endif
+    if (p == end || *p == '=' || *p == ';' || ISSPACE(*p)) {
+      return p;
+    }
+    // some other control character, which is part of the key
+    p++;
+  }
+}
+
+/*
+ * Classifies the line [line, end), not including its newline, in a single
+ * pass, and finds its key and value (or section name, in key).
+ * Nothing in the line is modified.
+ */
+static void lexline(char* line, char* end, int flags, struct initoken* tok) {
+  char* c = line;
+  while (c < end && ISSPACE(*c)) {
+    c++;
+  }
+
+  if (c == end) {
+    tok->kind = LINE_BLANK;
+    return;
+  }
+
+  if (*c == ';') {
+    tok->kind = LINE_COMMENT;
+    return;
+  }
+
+  if (*c == '[') {
+    char* close = memchr(c + 1, ']', end - c - 1);
+    if (close == NULL) {
+      // a header with no end, which mustn't be mistaken for a key
+      tok->kind = LINE_INVALID;
+      return;
+    }
+    if (close != c + 1) {
+      tok->kind = LINE_SECTION;
+      tok->key = c + 1;
+      tok->keylen = close - tok->key;
+      return;
+    }
+    // otherwise, "[]" is treated like any other key
+  }
+
+  tok->key = c;
+  c = findkeyend(c, end);
+  tok->keylen = c - tok->key;
+
+  if (tok->keylen == 0) {
+    tok->kind = LINE_INVALID;
+    return;
+  }
+
+  // a key is all there is unless a value turns up
+  tok->kind = LINE_KEY;
+  tok->val = NULL;
+  tok->vallen = 0;
+
+  if (flags & INIO_SPACE_AROUND_DELIM) {
+    while (c < end && ISSPACE(*c)) {
+      c++;
+    }
+    if (c == end || *c != '=') {
+      return;
+    }
+    c++;
+    while (c < end && ISSPACE(*c)) {
+      c++;
+    }
+    // the value is the rest of the line
+    tok->val = c;
+    tok->vallen = end - c;
+  } else {
+    if (c == end || *c != '=') {
+      return;
+    }
+    c++;
+    // the value runs up to the next space
+    tok->val = c;
+    c = memchr(c, ' ', end - c);
+    tok->vallen = (c == NULL ? end : c) - tok->val;
+  }
+
+  if (tok->vallen > 0) {
+    tok->kind = LINE_PAIR;
+  } else {
+    tok->val = NULL;
+  }
+}
+
+// sets up a parser loading into ini, or calling cb if ini is NULL
+static void parser_init(struct iniparser* p, struct inifile* ini,
+                        ini_pair_op cb, int flags) {
+  memset(p, 0, sizeof(struct iniparser));
+  p->ini = ini;
+  p->cb = cb;
+  if (ini != NULL) {
+    p->flags = ini->flags;
+    p->sec = ini->default_section;
+  } else {
+    p->flags = flags;
+    p->sec = &p->cbsec;
+  }
+}
+
+// frees whatever a parser allocated, but not the parser itself
+static void parser_cleanup(struct iniparser* p) {
+  free(p->line);
+  free(p->secname);
+  p->line = NULL;
+  p->secname = NULL;
+}
+
+// makes room for len more characters, plus a terminator, in a parser's line
+static int parser_reserve(struct iniparser* p, size_t len) {
+  if (p->linelen + len < p->linecap) {
+    return 0;
+  }
+
+  size_t cap = p->linecap ? p->linecap : 128;
+  while (cap <= p->linelen + len) {
+    cap *= 2;
+  }
+
+  char* line = realloc(p->line, cap);
+  if (line == NULL) {
+    perror("parser_reserve: realloc");
+    return 1;
+  }
+  p->line = line;
+  p->linecap = cap;
+  return 0;
+}
+
+// adds len characters of data to the end of a parser's line
+static int parser_append(struct iniparser* p, const char* data, size_t len) {
+  if (parser_reserve(p, len)) {
+    return 1;
+  }
+  memcpy(p->line + p->linelen, data, len);
+  p->linelen += len;
+  return 0;
+}
+
+// names the section handed to callbacks when there is no file
+static int parser_setsecname(struct iniparser* p, const char* name,
+                             size_t len) {
+  if (len >= p->secnamecap) {
+    char* secname = realloc(p->secname, len + 1);
+    if (secname == NULL) {
+      perror("parser_setsecname: realloc");
+      return 1;
+    }
+    p->secname = secname;
+    p->secnamecap = len + 1;
+  }
+  memcpy(p->secname, name, len);
+  p->secname[len] = '\0';
+  p->cbsec.name = p->secname;
+  return 0;
+}
+
+// hands a section and pair (NULL for the start of a section) to callbacks
+static void parser_emit(struct iniparser* p, struct inipair* pair) {
+  if (pair != NULL && p->cb != NULL) {
+    p->cb(p->sec, pair);
+  }
+  if (p->cbex != NULL) {
+    p->stopped = p->cbex(p->sec, pair, p->userdata);
+  }
+}
+
+/*
+ * Parses the line [line, end), not including its newline.
+ *
+ * With a file, the line is loaded into it. If borrow is set, keys, values
+ * and section names are terminated in place and used as-is rather than
+ * copied, in which case the line (and the byte at end) must be writable and
+ * live as long as the file. Otherwise the line is only read.
+ *
+ * Without a file, keys and values are always terminated in place so they can
+ * be handed straight to the callback, so the line must be writable.
+ */
+static void parseline(struct iniparser* p, char* line, char* end,
+                      int borrow) {
+  struct initoken tok;
+  lexline(line, end, p->flags, &tok);
+
+  if (tok.kind == LINE_KEY && !(p->flags & INIO_ALLOW_EMPTY)) {
+    return;
+  }
+
+  switch (tok.kind) {
+    case LINE_SECTION:
+      if (p->ini == NULL) {
+        if (0 == parser_setsecname(p, tok.key, tok.keylen)) {
+          parser_emit(p, NULL);
+        }
+      } else {
+        // set the current section, making it if it's new
+        struct inisection* s = getsection_n(p->ini, tok.key, tok.keylen,
+                                             strhash(tok.key, tok.keylen));
+        if (s == NULL) {
+          s = section_insertnew(p->ini, ini_makesection(p->ini, tok.key,
+                                                        tok.keylen, borrow));
+        }
+        p->sec = s;
+      }
+      break;
+    case LINE_PAIR:
+    case LINE_KEY:
+      if (p->ini == NULL) {
+        struct inipair pair = {0};
+        pair.key = tok.key;
+        tok.key[tok.keylen] = '\0';
+        if (tok.val != NULL) {
+          pair.val = tok.val;
+          tok.val[tok.vallen] = '\0';
+        }
+        parser_emit(p, &pair);
+      } else {
+        // insert the new key/value pair into the current section
+        struct inipair* pair = pair_insertnew(p->sec, ini_makepair(p->ini,
+            tok.key, tok.keylen, tok.val, tok.vallen, borrow));
+        if (pair != NULL) {
+          parser_emit(p, pair);
+        }
+      }
+      break;
+    default:
+      // blank lines, comments and anything unrecognized are skipped
+      break;
+  }
+}
+
+// parses whatever is left in a parser's line, which had no newline
+static void parser_flush(struct iniparser* p) {
+  if (p->linelen != 0 && !p->stopped) {
+    parseline(p, p->line, p->line + p->linelen, 0);
+  }
+  p->linelen = 0;
+}
+
+/*
+ * Parses len bytes of data one line at a time. See parseline() for the
+ * meaning of borrow; with a file, the data is only written to if it's set.
+ */
+static void parsebuf(struct iniparser* p, char* data, size_t len,
+                     int borrow) {
+  char* end = data + len;
+  for (char* line = data; line < end;) {
+    char* nl = memchr(line, '\n', end - line);
+    if (nl == NULL) {
+      // the last line has no newline, and there's no room to terminate its
+      // strings in the buffer, so they have to be copied
+      parseline(p, line, end, 0);
+      break;
+    }
+
+    parseline(p, line, nl, borrow);
+    line = nl + 1;
+  }
+}
+
+// feeds everything in a file to a parser, returns 0 on success, else 1
+static int parser_feedfile(struct iniparser* p, FILE* infile) {
+  char chunk[16384];
+  size_t len;
+  while (!p->stopped && (len = fread(chunk, 1, sizeof(chunk), infile)) != 0) {
+    if (ini_parser_feed(p, chunk, len)) {
+      return 1;
+    }
+  }
+
+  if (ferror(infile)) {
+    perror("parser_feedfile: fread");
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * Maps a whole file privately with the given protection, setting *data and
+ * *size. An empty file can't be mapped, so *data is NULL for one.
+ * Returns 0 on success, else 1.
+ */
+static int mapfile(char* filename, int prot, char** data, size_t* size) {
+  *data = NULL;
+  *size = 0;
+
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    perror("mapfile: open");
+    return 1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    perror("mapfile: fstat");
+    close(fd);
+    return 1;
+  }
+
+  if (st.st_size == 0) {
+    close(fd);
+    return 0;
+  }
+
+  char* addr = mmap(NULL, st.st_size, prot, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    perror("mapfile: mmap");
+    return 1;
+  }
+  *data = addr;
+  *size = st.st_size;
+  return 0;
+}
+
+// hands a mapping to a file, which unmaps it in freeini()
+static int ini_addmapping(struct inifile* inif, char* data, size_t size) {
+  struct inimapping* m = malloc(sizeof(struct inimapping));
+  if (m == NULL) {
+    perror("ini_addmapping: malloc");
+    return 1;
+  }
+  m->addr = data;
+  m->len = size;
+  m->next = inif->mappings;
+  inif->mappings = m;
+  return 0;
+}
+
+/*
+ * Loads a file for INIO_MMAP by mapping it privately, so that keys and values
+ * can be terminated in place and used straight out of the mapping. Only the
+ * pages written to get copied; the rest stay backed by the file, which is
+ * why it mustn't change while inif is alive.
+ * Returns 0 on success, else 1.
+ */
+static int mapinifile(struct inifile* inif, char* filename) {
+  char* data;
+  size_t size;
+  if (mapfile(filename, PROT_READ | PROT_WRITE, &data, &size)) {
+    return 1;
+  }
+  if (data == NULL) {
+    return 0;
+  }
+
+  if (ini_addmapping(inif, data, size)) {
+    munmap(data, size);
+    return 1;
+  }
+
+  struct iniparser p;
+  parser_init(&p, inif, NULL, 0);
+  parsebuf(&p, data, size, 1);
+  return 0;
+}
+
+int loadinifromfile(struct inifile* inif, char* filename) {
+  if (inif == NULL || filename == NULL || inif->default_section == NULL) {
+    return 1;
+  }
+
+  if (inif->flags & INIO_MMAP) {
+    return mapinifile(inif, filename);
+  }
+
+  FILE* infile = fopen(filename, "r");
+  if (NULL == infile) {
+    perror("loadinifromfile: fopen");
+    return 1;
+  }
+
+  // starts out inserting to the default section
+  struct iniparser p;
+  parser_init(&p, inif, NULL, 0);
+
+  int ret = parser_feedfile(&p, infile);
+  if (ret == 0) {
+    parser_flush(&p);
+  }
+
+  fclose(infile);
+  parser_cleanup(&p);
+
+  return ret;
+}
+
+int loadinifrombuffer(struct inifile* inif, const char* data, size_t len) {
+  if (inif == NULL || data == NULL || inif->default_section == NULL) {
+    return 1;
+  }
+
+  // without borrowing, the data is only ever read
+  struct iniparser p;
+  parser_init(&p, inif, NULL, 0);
+  parsebuf(&p, (char*)data, len, 0);
+  return 0;
+}
+
+struct inifile* newinifromfile(char* filename, int flags) {
+  if (filename == NULL) {
+    return NULL;
+  }
+
+  struct inifile* inif = makeini(flags);
+  if (inif == NULL) {
+    return NULL;
+  }
+
+  if (1 == loadinifromfile(inif, filename)) {
+    freeini(inif);
+    return NULL;
+  }
+
+  return inif;
+}
+
+// piece of a file parsed on its own by loadinifromfile_parallel()
+struct inichunk {
+  // file the piece is parsed into, which is later merged into the real one
+  struct inifile* ini;
+  char* data;
+  size_t len;
+  int borrow;
+  pthread_t thread;
+  int started;
+};
+
+static void* chunk_thread(void* arg) {
+  struct inichunk* c = arg;
+  struct iniparser p;
+  parser_init(&p, c->ini, NULL, 0);
+  parsebuf(&p, c->data, c->len, c->borrow);
+  return NULL;
+}
+
+/*
+ * Finds the first line starting in [from, limit) which is a section header,
+ * so nothing before it is needed to parse what follows. A line which is
+ * already underway at from is skipped. Returns NULL if there isn't one.
+ */
+static char* chunk_start(char* data, char* from, char* limit, char* end,
+                         int flags) {
+  char* line = from;
+  if (line > data && line[-1] != '\n') {
+    line = memchr(line, '\n', end - line);
+    if (line == NULL) {
+      return NULL;
+    }
+    line++;
+  }
+
+  while (line < limit) {
+    char* nl = memchr(line, '\n', end - line);
+    struct initoken tok;
+    lexline(line, nl == NULL ? end : nl, flags, &tok);
+    if (tok.kind == LINE_SECTION) {
+      return line;
+    }
+    if (nl == NULL) {
+      break;
+    }
+    line = nl + 1;
+  }
+  return NULL;
+}
+
+// replaces a name with the file's interned copy of it, for INIO_INTERN
+static void merge_intern(struct inifile* ini, char** name, size_t len,
+                         unsigned int* borrowed) {
+  char* copy = ini_internn(ini, *name, len);
+  if (copy == NULL) {
+    return;
+  }
+  if (!(*borrowed & BORROWED_KEY)) {
+    free(*name);
+  }
+  *name = copy;
+  *borrowed |= BORROWED_KEY;
+}
+
+// moves a pair from a chunk into a section, overwriting any with its key
+static void merge_pair(struct inifile* ini, struct inisection* dst,
+                       struct inipair* pair) {
+  pair->next = NULL;
+  if (ini->flags & INIO_INTERN) {
+    merge_intern(ini, &pair->key, pair->keylen, &pair->borrowed);
+  }
+  pair_insertnew(dst, pair);
+}
+
+// moves every pair in src into dst, overwriting any with the same key
+static void merge_pairs(struct inifile* ini, struct inisection* dst,
+                        struct inisection* src) {
+  struct inipair* pair = src->head;
+  src->head = NULL;
+  src->tail = NULL;
+  while (pair != NULL) {
+    struct inipair* next = pair->next;
+    merge_pair(ini, dst, pair);
+    pair = next;
+  }
+}
+
+/*
+ * Puts the pairs a chunk replaced while it was parsed into ini, oldest first,
+ * so that the changes are reported just as they would have been had the
+ * chunk been loaded into ini directly. The pairs which replaced them come
+ * after, with the rest of the chunk.
+ */
+static void merge_replaced(struct inifile* ini, struct inifile* part) {
+  struct inipair* pair = part->replaced->head;
+  part->replaced->head = NULL;
+  part->replaced->tail = NULL;
+  while (pair != NULL) {
+    struct inipair* next = pair->next;
+    struct inisection* from = pair->section;
+    struct inisection* dst = ini->default_section;
+    if (from->name != NULL) {
+      dst = getsection_n(ini, from->name, from->namelen, from->hash);
+      if (dst == NULL) {
+        dst = section_insertnew(ini, ini_makesection(ini, from->name,
+                                                     from->namelen, 0));
+      }
+    }
+    if (dst == NULL) {
+      freepair(pair);
+    } else {
+      merge_pair(ini, dst, pair);
+    }
+    pair = next;
+  }
+}
+
+/*
+ * Moves everything parsed from a chunk into ini, the same as if the chunk had
+ * been loaded into it directly, then frees what's left of the chunk's file.
+ * Sections which ini doesn't have yet are moved over whole.
+ */
+static void merge_chunk(struct inifile* ini, struct inifile* part) {
+  if (part->replaced != NULL) {
+    merge_replaced(ini, part);
+  }
+  merge_pairs(ini, ini->default_section, part->default_section);
+
+  struct inisection* sec = part->head;
+  part->head = NULL;
+  part->tail = NULL;
+  while (sec != NULL) {
+    struct inisection* next = sec->next;
+    sec->next = NULL;
+
+    struct inisection* s = getsection_n(ini, sec->name, sec->namelen,
+                                        sec->hash);
+    if (s != NULL) {
+      merge_pairs(ini, s, sec);
+      freesection(sec);
+    } else {
+      if (ini->flags & INIO_INTERN) {
+        merge_intern(ini, &sec->name, sec->namelen, &sec->borrowed);
+        for (struct inipair* pair = sec->head; pair; pair = pair->next) {
+          merge_intern(ini, &pair->key, pair->keylen, &pair->borrowed);
+        }
+      }
+      if (section_insert(ini, sec) == NULL) {
+        freesection(sec);
+      } else if (ini->subs != NULL) {
+        for (struct inipair* pair = sec->head; pair; pair = pair->next) {
+          subs_notify(sec, pair, INIC_ADDED);
+        }
+      }
+    }
+    sec = next;
+  }
+
+  if (part->heapowned) {
+    ini->heapowned = 1;
+  }
+  arena_splice(&ini->arena, &part->arena);
+  freeini(part);
+}
+
+int loadinifromfile_parallel(struct inifile* inif, char* filename,
+                             int nthreads) {
+  if (inif == NULL || filename == NULL || inif->default_section == NULL) {
+    return 1;
+  }
+
+  if (nthreads < 1) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = n < 1 ? 1 : n;
+  }
+
+  // with INIO_MMAP, the mapping is kept and everything borrows from it,
+  // including the pieces parsed into files of their own, which don't have
+  // INIO_MMAP set; it belongs to inif, so like mapinifile() it relies on the
+  // file staying as it is until inif is freed
+  int borrow = (inif->flags & INIO_MMAP) != 0;
+  char* data;
+  size_t size;
+  if (mapfile(filename, borrow ? PROT_READ | PROT_WRITE : PROT_READ,
+              &data, &size)) {
+    return 1;
+  }
+  if (data == NULL) {
+    return 0;
+  }
+  if (borrow && ini_addmapping(inif, data, size)) {
+    munmap(data, size);
+    return 1;
+  }
+
+  size_t nchunks = size / PARALLEL_MIN_CHUNK;
+  if (nchunks > (size_t)nthreads) {
+    nchunks = nthreads;
+  }
+  if (nchunks < 1) {
+    nchunks = 1;
+  }
+
+  struct inichunk* chunks = calloc(nchunks, sizeof(struct inichunk));
+  if (chunks == NULL) {
+    perror("loadinifromfile_parallel: calloc");
+    if (!borrow) {
+      munmap(data, size);
+    }
+    return 1;
+  }
+
+  // split the file at the first section header after each of a set of
+  // evenly spaced offsets, so every chunk after the first starts with one
+  char* end = data + size;
+  size_t n = 1;
+  chunks[0].data = data;
+  for (size_t i = 1; i < nchunks; i++) {
+    char* limit = i + 1 < nchunks ? data + size / nchunks * (i + 1) : end;
+    char* start = chunk_start(data, data + size / nchunks * i, limit, end,
+                              inif->flags);
+    if (start != NULL) {
+      chunks[n++].data = start;
+    }
+  }
+  for (size_t i = 0; i < n; i++) {
+    chunks[i].len = (i + 1 < n ? chunks[i + 1].data : end) - chunks[i].data;
+    chunks[i].borrow = borrow;
+  }
+
+  // every chunk but the first is parsed into a file of its own, which can't
+  // intern into ini's table, so merge_chunk() interns them instead
+  int ret = 0;
+  int partflags = inif->flags & ~(INIO_MMAP | INIO_INTERN);
+  for (size_t i = 1; i < n; i++) {
+    chunks[i].ini = makeini(partflags);
+    if (chunks[i].ini != NULL && inif->subs != NULL) {
+      // keep what each pair replaces, since only ini can report it
+      chunks[i].ini->replaced = calloc(1, sizeof(struct inireplaced));
+      if (chunks[i].ini->replaced == NULL) {
+        perror("loadinifromfile_parallel: calloc");
+        freeini(chunks[i].ini);
+        chunks[i].ini = NULL;
+      }
+    }
+    if (chunks[i].ini == NULL) {
+      ret = 1;
+      continue;
+    }
+    chunks[i].started = 0 == pthread_create(&chunks[i].thread, NULL,
+                                            chunk_thread, &chunks[i]);
+    if (!chunks[i].started) {
+      // parse it here instead, once the rest are underway
+      fprintf(stderr, "loadinifromfile_parallel: pthread_create failed\n");
+    }
+  }
+
+  // the first chunk goes straight into ini, which may already have data
+  struct iniparser p;
+  parser_init(&p, inif, NULL, 0);
+  parsebuf(&p, chunks[0].data, chunks[0].len, borrow);
+
+  // merging in order keeps the last of any duplicate keys, as usual
+  for (size_t i = 1; i < n; i++) {
+    if (chunks[i].ini == NULL) {
+      continue;
+    }
+    if (chunks[i].started) {
+      pthread_join(chunks[i].thread, NULL);
+    } else {
+      chunk_thread(&chunks[i]);
+    }
+    merge_chunk(inif, chunks[i].ini);
+  }
+
+  free(chunks);
+  if (!borrow) {
+    munmap(data, size);
+  }
+  return ret;
+}
+
+struct inifile* newinifromfile_parallel(char* filename, int flags,
+                                        int nthreads) {
+  if (filename == NULL) {
+    return NULL;
+  }
+
+  struct inifile* inif = makeini(flags);
+  if (inif == NULL) {
+    return NULL;
+  }
+
+  if (1 == loadinifromfile_parallel(inif, filename, nthreads)) {
+    freeini(inif);
+    return NULL;
+  }
+
+  return inif;
+}
+
+struct inifile* newinifrombuffer(const char* data, size_t len, int flags) {
+  if (data == NULL) {
+    return NULL;
+  }
+
+  struct inifile* inif = makeini(flags);
+  if (inif == NULL) {
+    return NULL;
+  }
+
+  if (1 == loadinifrombuffer(inif, data, len)) {
+    freeini(inif);
+    return NULL;
+  }
+
+  return inif;
+}
+
+struct iniparser* ini_parser_new(struct inifile* ini, ini_pair_op cb,
+                                 int flags) {
+  if (ini == NULL && cb == NULL) {
+    return NULL;
+  }
+  if (ini != NULL && ini->default_section == NULL) {
+    return NULL;
+  }
+
+  struct iniparser* p = malloc(sizeof(struct iniparser));
+  if (p == NULL) {
+    perror("ini_parser_new: malloc");
+    return NULL;
+  }
+  parser_init(p, ini, cb, flags);
+  return p;
+}
+
+int ini_parser_feed(struct iniparser* p, const char* chunk, size_t len) {
+  if (p == NULL || (chunk == NULL && len != 0)) {
+    return 1;
+  }
+
+  const char* end = chunk + len;
+  while (chunk < end && !p->stopped) {
+    const char* nl = memchr(chunk, '\n', end - chunk);
+    if (nl == NULL) {
+      // hang on to the start of the line until the rest of it shows up
+      return parser_append(p, chunk, end - chunk);
+    }
+
+    if (p->linelen == 0 && p->ini != NULL) {
+      // the whole line is here, and loading it only reads it
+      parseline(p, (char*)chunk, (char*)nl, 0);
+    } else {
+      if (parser_append(p, chunk, nl - chunk)) {
+        return 1;
+      }
+      parseline(p, p->line, p->line + p->linelen, 0);
+      p->linelen = 0;
+    }
+    chunk = nl + 1;
+  }
+
+  return 0;
+}
+
+int ini_parser_finish(struct iniparser* p) {
+  if (p == NULL) {
+    return 1;
+  }
+
+  parser_flush(p);
+  parser_cleanup(p);
+  free(p);
+  return 0;
+}
+
+int ini_parse_stream(char* filename, int flags, ini_pair_op_ex cb,
+                     void* userdata) {
+  if (filename == NULL || cb == NULL) {
+    return 1;
+  }
+
+  FILE* infile = fopen(filename, "r");
+  if (NULL == infile) {
+    perror("ini_parse_stream: fopen");
+    return 1;
+  }
+
+  struct iniparser p;
+  parser_init(&p, NULL, NULL, flags);
+  p.cbex = cb;
+  p.userdata = userdata;
+
+  int ret = parser_feedfile(&p, infile);
+  if (ret == 0) {
+    parser_flush(&p);
+    ret = p.stopped;
+  }
+
+  fclose(infile);
+  parser_cleanup(&p);
+  return ret;
+}
+
+int ini_parse_stream_buffer(const char* data, size_t len, int flags,
+                            ini_pair_op_ex cb, void* userdata) {
+  if (data == NULL || cb == NULL) {
+    return 1;
+  }
+
+  struct iniparser p;
+  parser_init(&p, NULL, NULL, flags);
+  p.cbex = cb;
+  p.userdata = userdata;
+
+  int ret = ini_parser_feed(&p, data, len);
+  if (ret == 0) {
+    parser_flush(&p);
+    ret = p.stopped;
+  }
+
+  parser_cleanup(&p);
+  return ret;
+}
+
+void parseini(struct inifile* ini, ini_pair_op cb) {
+  ini_foreach(ini, cb);
+}
+
+void ini_foreach(struct inifile* ini, ini_pair_op cb) {
+  for (struct inipair* p = ini->default_section->head; p; p = p->next) {
+    cb(ini->default_section, p);
+  }
+
+  for (struct inisection* s = ini->head; s; s = s->next) {
+    for (struct inipair* p = s->head; p; p = p->next) {
+      cb(s, p);
+    }
+  }
+}
+
+int ini_foreach_ex(struct inifile* ini, ini_pair_op_ex cb, void* userdata) {
+  int ret;
+  for (struct inipair* p = ini->default_section->head; p; p = p->next) {
+    if ((ret = cb(ini->default_section, p, userdata))) {
+      return ret;
+    }
+  }
+
+  for (struct inisection* s = ini->head; s; s = s->next) {
+    for (struct inipair* p = s->head; p; p = p->next) {
+      if ((ret = cb(s, p, userdata))) {
+        return ret;
+      }
+    }
+  }
+
+  return 0;
+}
+
+struct inisection* ini_getsection(struct inifile* ini, char* name) {
+  if (ini == NULL) {
+    return NULL;
+  }
+
+  if (name == NULL) {
+    return ini->default_section;
+  }
+
+  size_t len = strlen(name);
+  return getsection_n(ini, name, len, strhash(name, len));
+}
+
+struct inipair* inisection_getpair(struct inisection* section, char* key) {
+  if (section == NULL || key == NULL) {
+    return NULL;
+  }
+
+  size_t len = strlen(key);
+  return getpair_n(section, key, len, strhash(key, len));
+}
+
+struct inipair* ini_getpair(struct inifile* ini, char* section, char* key) {
+  struct inisection* s = ini_getsection(ini, section);
+  if (s == NULL) {
+    return NULL;
+  }
+
+  return inisection_getpair(s, key);
+}
+
+struct inikey ini_makekey(const char* str) {
+  struct inikey key = {str, 0, 0};
+  if (str != NULL) {
+    key.len = strlen(str);
+    key.hash = strhash(str, key.len);
+  }
+  return key;
+}
+
+struct inisection* ini_getsection_key(struct inifile* ini,
+                                      const struct inikey* name) {
+  if (ini == NULL) {
+    return NULL;
+  }
+
+  if (name == NULL || name->str == NULL) {
+    return ini->default_section;
+  }
+
+  return getsection_n(ini, name->str, name->len, name->hash);
+}
+
+struct inipair* inisection_getpair_key(struct inisection* section,
+                                       const struct inikey* key) {
+  if (section == NULL || key == NULL || key->str == NULL) {
+    return NULL;
+  }
+
+  return getpair_n(section, key->str, key->len, key->hash);
+}
+
+struct inipair* ini_getpair_key(struct inifile* ini,
+                                const struct inikey* section,
+                                const struct inikey* key) {
+  return inisection_getpair_key(ini_getsection_key(ini, section), key);
+}
+
+// parses a string into a value, returning 0 on success or 1 on failure
+typedef int (*value_parser)(const char* str, union inivalue* out);
+
+static int parse_int64(const char* str, union inivalue* out) {
+  const char* c = str;
+  if (*c == '+' || *c == '-') {
+    c++;
+  }
+  int base = 10;
+  if (c[0] == '0' && (c[1] == 'x' || c[1] == 'X')) {
+    base = 16;
+  }
+  // strtoll() allows leading spaces, and a second sign after the first
+  if (base == 16 ? !isxdigit((unsigned char)c[2])
+                 : !isdigit((unsigned char)c[0])) {
+    return 1;
+  }
+
+  char* end;
+  errno = 0;
+  long long v = strtoll(str, &end, base);
+  if (errno != 0 || *end != '\0') {
+    return 1;
+  }
+  out->i = v;
+  return 0;
+}
+
+static int parse_double(const char* str, union inivalue* out) {
+  if (*str == '\0' || ISSPACE(*str)) {
+    return 1;
+  }
+
+  char* end;
+  errno = 0;
+  double v = strtod(str, &end);
+  if (errno == ERANGE || *end != '\0') {
+    return 1;
+  }
+  out->d = v;
+  return 0;
+}
+
+static int parse_bool(const char* str, union inivalue* out) {
+  static const char* const yes[] = {"true", "yes", "on", "1"};
+  static const char* const no[] = {"false", "no", "off", "0"};
+  for (size_t i = 0; i < sizeof(yes) / sizeof(*yes); i++) {
+    if (0 == strcasecmp(str, yes[i])) {
+      out->i = 1;
+      return 0;
+    }
+    if (0 == strcasecmp(str, no[i])) {
+      out->i = 0;
+      return 0;
+    }
+  }
+  return 1;
+}
+
+struct valunit {
+  const char* name;
+  uint64_t scale;
+};
+
+static const struct valunit duration_units[] = {
+  {"ns", 1ULL},
+  {"us", 1000ULL},
+  {"ms", 1000000ULL},
+  {"s", 1000000000ULL},
+  {"m", 60000000000ULL},
+  {"h", 3600000000000ULL},
+  {"d", 86400000000000ULL},
+  {NULL, 0},
+};
+
+static const struct valunit size_units[] = {
+  {"b", 1ULL},
+  {"k", 1ULL << 10},
+  {"kib", 1ULL << 10},
+  {"kb", 1000ULL},
+  {"m", 1ULL << 20},
+  {"mib", 1ULL << 20},
+  {"mb", 1000000ULL},
+  {"g", 1ULL << 30},
+  {"gib", 1ULL << 30},
+  {"gb", 1000000000ULL},
+  {"t", 1ULL << 40},
+  {"tib", 1ULL << 40},
+  {"tb", 1000000000000ULL},
+  {NULL, 0},
+};
+
+/*
+ * Parses a number with an optional fraction followed by a unit from the
+ * given table, starting at *str and moving *str past it. Units are matched
+ * ignoring case if nocase is set. Unless needunit is set, the unit may be left
+ * off a whole number. Adds the number times its unit's scale to *total.
+ * Returns 0 on success, or 1 if the number is malformed, its unit isn't in
+ * the table, or *total would overflow.
+ */
+static int parse_scaled(const char** str, const struct valunit* units,
+                        int nocase, int needunit, uint64_t* total) {
+  const char* c = *str;
+  if (!isdigit((unsigned char)*c)) {
+    return 1;
+  }
+
+  uint64_t whole = 0;
+  for (; isdigit((unsigned char)*c); c++) {
+    if (whole > (UINT64_MAX - 9) / 10) {
+      return 1;
+    }
+    whole = whole * 10 + (*c - '0');
+  }
+
+  // only the first 9 digits of a fraction count, which is plenty for
+  // nanoseconds and bytes, and keeps the arithmetic below from overflowing
+  uint64_t frac = 0;
+  uint64_t den = 1;
+  if (*c == '.') {
+    c++;
+    if (!isdigit((unsigned char)*c)) {
+      return 1;
+    }
+    for (; isdigit((unsigned char)*c); c++) {
+      if (den < 1000000000ULL) {
+        frac = frac * 10 + (*c - '0');
+        den *= 10;
+      }
+    }
+  }
+
+  const char* unit = c;
+  while (isalpha((unsigned char)*c)) {
+    c++;
+  }
+  size_t unitlen = c - unit;
+  uint64_t scale = 0;
+  for (const struct valunit* u = units; unitlen != 0 && u->name; u++) {
+    if (strlen(u->name) == unitlen
+        && 0 == (nocase ? strncasecmp(unit, u->name, unitlen)
+                        : strncmp(unit, u->name, unitlen))) {
+      scale = u->scale;
+      break;
+    }
+  }
+  if ((unitlen != 0 || needunit) && scale == 0) {
+    return 1;
+  }
+
+  *str = c;
+  if (scale == 0) {
+    // unitless numbers are counted as is, and must be whole
+    if (den != 1 || *total > UINT64_MAX - whole) {
+      return 1;
+    }
+    *total += whole;
+    return 0;
+  }
+
+  if (whole > UINT64_MAX / scale) {
+    return 1;
+  }
+  uint64_t v = whole * scale;
+  uint64_t f = frac * (scale / den) + frac * (scale % den) / den;
+  if (v > UINT64_MAX - f || *total > UINT64_MAX - (v + f)) {
+    return 1;
+  }
+  *total += v + f;
+  return 0;
+}
+
+static int parse_duration(const char* str, union inivalue* out) {
+  int neg = *str == '-';
+  if (*str == '+' || *str == '-') {
+    str++;
+  }
+  if (0 == strcmp(str, "0")) {
+    out->i = 0;
+    return 0;
+  }
+
+  uint64_t ns = 0;
+  do {
+    if (parse_scaled(&str, duration_units, 0, 1, &ns)) {
+      return 1;
+    }
+  } while (*str != '\0');
+
+  if (ns > (uint64_t)INT64_MAX + neg) {
+    return 1;
+  }
+  // INT64_MIN can't be negated, so this goes the long way around
+  out->i = neg && ns != 0 ? -(int64_t)(ns - 1) - 1 : (int64_t)ns;
+  return 0;
+}
+
+static int parse_size(const char* str, union inivalue* out) {
+  uint64_t bytes = 0;
+  if (parse_scaled(&str, size_units, 1, 0, &bytes) || *str != '\0') {
+    return 1;
+  }
+  out->u = bytes;
+  return 0;
+}
+
+/*
+ * Gets the value of a pair parsed with the given parser, using the pair's
+ * parsed value if it was already parsed as the given type. Returns 0 on
+ * success, or 1 if the pair has no value or it can't be parsed.
+ */
+static int pair_getvalue(struct inipair* p, unsigned int type,
+                         value_parser parse, union inivalue* out) {
+  if (p->val == NULL) {
+    return 1;
+  }
+
+  if ((p->valtype & ~VAL_INVALID) != type) {
+    p->valtype = type;
+    if (parse(p->val, &p->parsed)) {
+      p->valtype |= VAL_INVALID;
+    }
+  }
+
+  if (p->valtype & VAL_INVALID) {
+    return 1;
+  }
+  *out = p->parsed;
+  return 0;
+}
+
+/*
+ * Gets the value of a key parsed with the given parser, as pair_getvalue()
+ * does. Returns 0 on success, or 1 if the key doesn't exist, has no value,
+ * or can't be parsed.
+ */
+static int ini_getvalue(struct inifile* ini, char* section, char* key,
+                        unsigned int type, value_parser parse,
+                        union inivalue* out) {
+  struct inipair* p = ini_getpair(ini, section, key);
+  if (p == NULL) {
+    return 1;
+  }
+  return pair_getvalue(p, type, parse, out);
+}
+
+int ini_get_int64(struct inifile* ini, char* section, char* key,
+                  int64_t* out) {
+  union inivalue v;
+  if (out == NULL || ini_getvalue(ini, section, key, VAL_INT64, parse_int64,
+                                  &v)) {
+    return 1;
+  }
+  *out = v.i;
+  return 0;
+}
+
+int ini_get_double(struct inifile* ini, char* section, char* key,
+                   double* out) {
+  union inivalue v;
+  if (out == NULL || ini_getvalue(ini, section, key, VAL_DOUBLE, parse_double,
+                                  &v)) {
+    return 1;
+  }
+  *out = v.d;
+  return 0;
+}
+
+int ini_get_bool(struct inifile* ini, char* section, char* key, int* out) {
+  union inivalue v;
+  if (out == NULL || ini_getvalue(ini, section, key, VAL_BOOL, parse_bool,
+                                  &v)) {
+    return 1;
+  }
+  *out = (int)v.i;
+  return 0;
+}
+
+int ini_get_duration_ns(struct inifile* ini, char* section, char* key,
+                        int64_t* out) {
+  union inivalue v;
+  if (out == NULL || ini_getvalue(ini, section, key, VAL_DURATION,
+                                  parse_duration, &v)) {
+    return 1;
+  }
+  *out = v.i;
+  return 0;
+}
+
+int ini_get_size_bytes(struct inifile* ini, char* section, char* key,
+                       uint64_t* out) {
+  union inivalue v;
+  if (out == NULL || ini_getvalue(ini, section, key, VAL_SIZE, parse_size,
+                                  &v)) {
+    return 1;
+  }
+  *out = v.u;
+  return 0;
+}
+
+// how ini_bind() handles each INI_TYPE
+static const struct {
+  unsigned int valtype;
+  value_parser parse;
+} bind_types[] = {
+  [INIV_STRING] = {VAL_NONE, NULL},
+  [INIV_INT64] = {VAL_INT64, parse_int64},
+  [INIV_DOUBLE] = {VAL_DOUBLE, parse_double},
+  [INIV_BOOL] = {VAL_BOOL, parse_bool},
+  [INIV_DURATION_NS] = {VAL_DURATION, parse_duration},
+  [INIV_SIZE_BYTES] = {VAL_SIZE, parse_size},
+};
+
+// orders fields the same way sections and pairs are ordered
+static int bind_cmp(const void* a, const void* b) {
+  const struct inifield* x = *(const struct inifield* const*)a;
+  const struct inifield* y = *(const struct inifield* const*)b;
+  if (x->section != y->section) {
+    if (x->section == NULL || y->section == NULL) {
+      return x->section == NULL ? -1 : 1;
+    }
+    int s = strcmp(x->section, y->section);
+    if (s != 0) {
+      return s;
+    }
+  }
+  return strcmp(x->key, y->key);
+}
+
+// fills in a single field from a pair, returning its status
+static enum INI_BIND bind_field(const struct inifield* f, struct inipair* p,
+                                void* dest) {
+  if (p == NULL) {
+    return INIB_MISSING;
+  }
+
+  char* field = (char*)dest + f->offset;
+  if (f->type == INIV_STRING) {
+    memcpy(field, &p->val, sizeof(char*));
+    return INIB_OK;
+  }
+
+  union inivalue v;
+  if (pair_getvalue(p, bind_types[f->type].valtype, bind_types[f->type].parse,
+                    &v)) {
+    return INIB_INVALID;
+  }
+
+  switch (f->type) {
+  case INIV_BOOL: {
+    int b = (int)v.i;
+    memcpy(field, &b, sizeof(int));
+    break;
+  }
+  case INIV_DOUBLE:
+    memcpy(field, &v.d, sizeof(double));
+    break;
+  case INIV_SIZE_BYTES:
+    memcpy(field, &v.u, sizeof(uint64_t));
+    break;
+  default:
+    memcpy(field, &v.i, sizeof(int64_t));
+    break;
+  }
+  return INIB_OK;
+}
+
+// whether two fields are in the same section
+static int bind_samesection(const struct inifield* a,
+                            const struct inifield* b) {
+  if (a->section == NULL || b->section == NULL) {
+    return a->section == b->section;
+  }
+  return 0 == strcmp(a->section, b->section);
+}
+
+long ini_bind(struct inifile* ini, const struct inifield* fields,
+              size_t nfields, void* dest, enum INI_BIND* status) {
+  if (ini == NULL || (fields == NULL && nfields != 0) || dest == NULL) {
+    return -1;
+  }
+  for (size_t i = 0; i < nfields; i++) {
+    if (fields[i].key == NULL || (unsigned)fields[i].type > INIV_SIZE_BYTES) {
+      return -1;
+    }
+  }
+
+  // one spare so that nothing is malloc(0)
+  const struct inifield** sorted = malloc((nfields + 1) * sizeof(*sorted));
+  if (sorted == NULL) {
+    perror("ini_bind: malloc");
+    return -1;
+  }
+  // tables of fields are usually written in order already
+  int inorder = 1;
+  for (size_t i = 0; i < nfields; i++) {
+    sorted[i] = &fields[i];
+    if (i != 0 && inorder && bind_cmp(&sorted[i - 1], &sorted[i]) > 0) {
+      inorder = 0;
+    }
+  }
+  if (!inorder) {
+    qsort(sorted, nfields, sizeof(*sorted), bind_cmp);
+  }
+
+  long failed = 0;
+  for (size_t i = 0; i < nfields;) {
+    size_t end = i + 1;
+    while (end < nfields && bind_samesection(sorted[i], sorted[end])) {
+      end++;
+    }
+
+    // the fields and the section's pairs are in the same order, so they can
+    // be matched up in one walk through the section, but only a few fields
+    // from a big section are quicker to look up one at a time
+    struct inisection* sec = ini_getsection(ini, sorted[i]->section);
+    int walk = sec != NULL && (end - i) * BIND_WALK_RATIO >= sec->pairs.count;
+    struct inipair* p = sec == NULL ? NULL : sec->head;
+    for (; i < end; i++) {
+      const struct inifield* f = sorted[i];
+      struct inipair* pair = NULL;
+      if (walk) {
+        while (p != NULL && strcmp(p->key, f->key) < 0) {
+          p = p->next;
+        }
+        if (p != NULL && 0 == strcmp(p->key, f->key)) {
+          pair = p;
+        }
+      } else if (sec != NULL) {
+        pair = inisection_getpair(sec, f->key);
+      }
+
+      enum INI_BIND result = bind_field(f, pair, dest);
+      if (status != NULL) {
+        status[f - fields] = result;
+      }
+      failed += result != INIB_OK;
+    }
+  }
+
+  free(sorted);
+  return failed;
+}
+
+// records a change, returning 0 on success or 1 on failure
+static int changeset_add(struct inichangeset* cs, enum INI_CHANGE kind,
+                         const char* section, const char* key,
+                         struct inipair* pair) {
+  if (cs->count == cs->cap) {
+    size_t cap = cs->cap ? cs->cap * 2 : 16;
+    struct inichange* changes = realloc(cs->changes,
+                                        cap * sizeof(struct inichange));
+    if (changes == NULL) {
+      perror("changeset_add: realloc");
+      return 1;
+    }
+    cs->changes = changes;
+    cs->cap = cap;
+  }
+
+  struct inichange* c = &cs->changes[cs->count];
+  c->kind = kind;
+  c->section = NULL;
+  c->key = strdup(key);
+  c->pair = pair;
+  if (section != NULL) {
+    c->section = strdup(section);
+  }
+  if (c->key == NULL || (section != NULL && c->section == NULL)) {
+    perror("changeset_add: strdup");
+    free(c->key);
+    free(c->section);
+    return 1;
+  }
+  cs->count++;
+  return 0;
+}
+
+static int sameval(const char* a, const char* b) {
+  if (a == NULL || b == NULL) {
+    return a == b;
+  }
+  return 0 == strcmp(a, b);
+}
+
+/*
+ * Makes the pairs in live match those in fresh, which may be NULL to remove
+ * every pair. Both lists are sorted by key, so they're walked side by side.
+ * Returns 0 on success, 1 on failure.
+ */
+static int reload_section(struct inifile* ini, struct inisection* live,
+                          struct inisection* fresh, struct inichangeset* cs) {
+  struct inipair* prev = NULL;
+  struct inipair* p = live->head;
+  struct inipair* q = fresh == NULL ? NULL : fresh->head;
+  while (p != NULL || q != NULL) {
+    int cmp = p == NULL ? 1 : q == NULL ? -1 : strcmp(p->key, q->key);
+    if (cmp < 0) {
+      // only in the live file
+      if (changeset_add(cs, INIC_REMOVED, live->name, p->key, NULL)) {
+        return 1;
+      }
+      struct inipair* next = p->next;
+      pair_unlink(live, prev, p);
+      freepair(p);
+      p = next;
+    } else if (cmp > 0) {
+      // only in the new file
+      if (index_reserve(&live->pairs, file_arena(ini))) {
+        return 1;
+      }
+      struct inipair* pair = ini_makepair(ini, q->key, q->keylen, q->val,
+                                          q->val ? strlen(q->val) : 0, 0);
+      if (pair == NULL) {
+        return 1;
+      }
+      pair->keylen = q->keylen;
+      pair->hash = q->hash;
+      pair_link(live, prev, pair);
+      if (changeset_add(cs, INIC_ADDED, live->name, pair->key, pair)) {
+        return 1;
+      }
+      prev = pair;
+      q = q->next;
+    } else {
+      if (!sameval(p->val, q->val)) {
+        if (NULL == pair_setval(p, q->val) && q->val != NULL) {
+          return 1;
+        }
+        if (changeset_add(cs, INIC_CHANGED, live->name, p->key, p)) {
+          return 1;
+        }
+      }
+      prev = p;
+      p = p->next;
+      q = q->next;
+    }
+  }
+  return 0;
+}
+
+struct inichangeset* ini_reload_incremental(struct inifile* ini,
+                                            char* filename) {
+  // a mapped file borrows from the very file that's being changed
+  if (ini == NULL || filename == NULL || (ini->flags & INIO_MMAP)) {
+    return NULL;
+  }
+
+  // the new version is only read from, so it can skip interning and live
+  // in an arena
+  struct inifile* fresh = newinifromfile(filename,
+                                         (ini->flags & ~INIO_INTERN)
+                                             | INIO_ARENA);
+  if (fresh == NULL) {
+    return NULL;
+  }
+  struct inichangeset* cs = calloc(1, sizeof(struct inichangeset));
+  if (cs == NULL) {
+    perror("ini_reload_incremental: calloc");
+    freeini(fresh);
+    return NULL;
+  }
+
+  // what's added here is freed again once it's removed by a later reload, so
+  // it comes from malloc even if ini has an arena, which would only grow
+  int flags = ini->flags;
+  ini->flags &= ~INIO_ARENA;
+
+  if (reload_section(ini, ini->default_section, fresh->default_section, cs)) {
+    goto fail;
+  }
+
+  struct inisection* prev = NULL;
+  struct inisection* s = ini->head;
+  struct inisection* t = fresh->head;
+  while (s != NULL || t != NULL) {
+    int cmp = s == NULL ? 1 : t == NULL ? -1 : strcmp(s->name, t->name);
+    if (cmp < 0) {
+      // only in the live file
+      if (reload_section(ini, s, NULL, cs)) {
+        goto fail;
+      }
+      struct inisection* next = s->next;
+      section_unlink(ini, prev, s);
+      freesection(s);
+      s = next;
+    } else if (cmp > 0) {
+      // only in the new file
+      if (index_reserve(&ini->sections, file_arena(ini))) {
+        goto fail;
+      }
+      struct inisection* sec = ini_makesection(ini, t->name, t->namelen, 0);
+      if (sec == NULL) {
+        goto fail;
+      }
+      sec->namelen = t->namelen;
+      sec->hash = t->hash;
+      section_link(ini, prev, sec);
+      if (reload_section(ini, sec, t, cs)) {
+        goto fail;
+      }
+      prev = sec;
+      t = t->next;
+    } else {
+      if (reload_section(ini, s, t, cs)) {
+        goto fail;
+      }
+      prev = s;
+      s = s->next;
+      t = t->next;
+    }
+  }
+
+  ini->flags = flags;
+  freeini(fresh);
+  return cs;
+
+fail:
+  ini->flags = flags;
+  freeini(fresh);
+  ini_changeset_free(cs);
+  return NULL;
+}
+
+void ini_changeset_free(struct inichangeset* cs) {
+  if (cs == NULL) {
+    return;
+  }
+
+  for (size_t i = 0; i < cs->count; i++) {
+    free(cs->changes[i].section);
+    free(cs->changes[i].key);
+  }
+  free(cs->changes);
+  free(cs);
+}
+
+// gets the subscriptions for a section, making them if there are none yet
+static struct inisubsection* subs_getsection(struct inisubs* subs,
+                                             const char* name) {
+  struct inisubsection** ss = &subs->default_section;
+  size_t len = 0;
+  unsigned long hash = 0;
+  if (name != NULL) {
+    len = strlen(name);
+    hash = strhash(name, len);
+    struct inislot* slot = index_lookup(&subs->sections, name, len, hash,
+                                        subsection_match);
+    if (slot != NULL) {
+      return slot->item;
+    }
+    if (index_reserve(&subs->sections, NULL)) {
+      return NULL;
+    }
+  } else if (*ss != NULL) {
+    return *ss;
+  }
+
+  struct inisubsection* s = calloc(1, sizeof(struct inisubsection));
+  if (s == NULL || (name != NULL && (s->name = strdup(name)) == NULL)) {
+    perror("subs_getsection: calloc");
+    free(s);
+    return NULL;
+  }
+  s->namelen = len;
+  if (name == NULL) {
+    *ss = s;
+  } else {
+    index_add(&subs->sections, s, hash);
+  }
+  return s;
+}
+
+// counts another subscription to a prefix of the given length
+static int subsection_addprefixlen(struct inisubsection* ss, size_t len) {
+  size_t i = 0;
+  while (i < ss->nprefixlens && ss->prefixlens[i] < len) {
+    i++;
+  }
+  if (i < ss->nprefixlens && ss->prefixlens[i] == len) {
+    ss->prefixrefs[i]++;
+    return 0;
+  }
+
+  size_t n = ss->nprefixlens + 1;
+  size_t* lens = realloc(ss->prefixlens, n * sizeof(size_t));
+  if (lens == NULL) {
+    perror("subsection_addprefixlen: realloc");
+    return 1;
+  }
+  ss->prefixlens = lens;
+  size_t* refs = realloc(ss->prefixrefs, n * sizeof(size_t));
+  if (refs == NULL) {
+    perror("subsection_addprefixlen: realloc");
+    return 1;
+  }
+  ss->prefixrefs = refs;
+
+  memmove(&lens[i + 1], &lens[i], (ss->nprefixlens - i) * sizeof(size_t));
+  memmove(&refs[i + 1], &refs[i], (ss->nprefixlens - i) * sizeof(size_t));
+  lens[i] = len;
+  refs[i] = 1;
+  ss->nprefixlens = n;
+  return 0;
+}
+
+struct inisub* ini_subscribe(struct inifile* ini, char* section, char* key,
+                             ini_change_op cb, void* userdata) {
+  if (ini == NULL || key == NULL || cb == NULL) {
+    return NULL;
+  }
+
+  if (ini->subs == NULL) {
+    ini->subs = calloc(1, sizeof(struct inisubs));
+    if (ini->subs == NULL) {
+      perror("ini_subscribe: calloc");
+      return NULL;
+    }
+  }
+  struct inisubsection* ss = subs_getsection(ini->subs, section);
+  if (ss == NULL) {
+    return NULL;
+  }
+
+  size_t len = strlen(key);
+  int prefix = len != 0 && key[len - 1] == '*';
+  if (prefix) {
+    len--;
+  }
+  struct iniindex* idx = prefix ? &ss->prefixes : &ss->keys;
+  unsigned long hash = strhash(key, len);
+
+  struct inisub* sub = calloc(1, sizeof(struct inisub));
+  if (sub == NULL) {
+    perror("ini_subscribe: calloc");
+    return NULL;
+  }
+
+  struct inislot* slot = index_lookup(idx, key, len, hash, subkey_match);
+  struct inisubkey* k = slot == NULL ? NULL : slot->item;
+  if (k == NULL) {
+    k = calloc(1, sizeof(struct inisubkey));
+    if (k == NULL || (k->key = strndup(key, len)) == NULL
+        || index_reserve(idx, NULL)) {
+      perror("ini_subscribe: calloc");
+      if (k != NULL) {
+        free(k->key);
+      }
+      free(k);
+      free(sub);
+      return NULL;
+    }
+    k->keylen = len;
+    index_add(idx, k, hash);
+  }
+  if (prefix && subsection_addprefixlen(ss, len)) {
+    // a prefix just added for this has nothing subscribed to it
+    if (k->subs == NULL) {
+      index_remove(idx, index_lookup(idx, key, len, hash, subkey_match));
+      free(k->key);
+      free(k);
+    }
+    free(sub);
+    return NULL;
+  }
+
+  sub->owner = k;
+  sub->section = ss;
+  sub->prefix = prefix;
+  sub->cb = cb;
+  sub->userdata = userdata;
+  sub->next = k->subs;
+  k->subs = sub;
+  return sub;
+}
+
+void ini_unsubscribe(struct inifile* ini, struct inisub* sub) {
+  if (ini == NULL || sub == NULL) {
+    return;
+  }
+
+  struct inisub** link = &sub->owner->subs;
+  while (*link != sub) {
+    link = &(*link)->next;
+  }
+  *link = sub->next;
+
+  // a prefix length no longer in use is dropped so changes don't keep
+  // looking it up, though not while changes are being reported
+  struct inisubsection* ss = sub->section;
+  struct inisubkey* k = sub->owner;
+  for (size_t i = 0; sub->prefix && i < ss->nprefixlens; i++) {
+    if (ss->prefixlens[i] == k->keylen) {
+      if (--ss->prefixrefs[i] == 0) {
+        ss->stale = 1;
+        if (ss->dispatching == 0) {
+          subsection_compact(ss);
+        }
+      }
+      break;
+    }
+  }
+
+  // so is a key or prefix with nothing left subscribed to it
+  if (k->subs == NULL) {
+    struct iniindex* idx = sub->prefix ? &ss->prefixes : &ss->keys;
+    index_remove(idx, index_lookup(idx, k->key, k->keylen,
+                                   strhash(k->key, k->keylen), subkey_match));
+    free(k->key);
+    free(k);
+  }
+  free(sub);
+}
+
+struct inipath {
+  struct inifile* ini;
+  // the section's str is NULL for the default section
+  struct inikey section;
+  struct inikey key;
+  // where the names were last found, and the generations they were found in
+  struct inisection* sec;
+  struct inipair* pair;
+  unsigned long filegen;
+  unsigned long secgen;
+};
+
+static void path_resolve(struct inipath* path) {
+  path->sec = ini_getsection_key(path->ini, &path->section);
+  path->pair = inisection_getpair_key(path->sec, &path->key);
+  path->filegen = path->ini->generation;
+  path->secgen = path->sec == NULL ? 0 : path->sec->generation;
+}
+
+struct inipath* ini_path_compile(struct inifile* ini, char* section,
+                                 char* key) {
+  if (ini == NULL || key == NULL) {
+    return NULL;
+  }
+
+  // the names are kept right after the handle
+  size_t seclen = section == NULL ? 0 : strlen(section) + 1;
+  size_t keylen = strlen(key) + 1;
+  struct inipath* path = malloc(sizeof(struct inipath) + seclen + keylen);
+  if (path == NULL) {
+    perror("ini_path_compile: malloc");
+    return NULL;
+  }
+
+  char* names = (char*)(path + 1);
+  path->ini = ini;
+  path->section = ini_makekey(NULL);
+  if (section != NULL) {
+    memcpy(names, section, seclen);
+    path->section = ini_makekey(names);
+  }
+  memcpy(names + seclen, key, keylen);
+  path->key = ini_makekey(names + seclen);
+  path_resolve(path);
+  return path;
+}
+
+struct inipair* ini_path_get(struct inipath* path) {
+  if (path == NULL) {
+    return NULL;
+  }
+
+  // a section's generation can only be read while the file's is unchanged,
+  // since the section may have been freed otherwise
+  if (path->filegen != path->ini->generation
+      || (path->sec != NULL && path->secgen != path->sec->generation)) {
+    path_resolve(path);
+  }
+  return path->pair;
+}
+
+void ini_path_free(struct inipath* path) {
+  free(path);
+}
+
+char* ini_intern(struct inifile* ini, char* str) {
+  if (ini == NULL || str == NULL) {
+    return NULL;
+  }
+
+  return ini_internn(ini, str, strlen(str));
+}
+
+int writeinitofile(struct inifile* ini, char* filename) {
+  if (ini == NULL || filename == NULL) {
+    return 1;
+  }
+
+  FILE* outfile = fopen(filename, "w");
+  if (outfile == NULL) {
+    perror("writeinitofile: fopen");
+    return 1;
+  }
+
+  for (struct inipair* p = ini->default_section->head; p; p = p->next) {
+    if (p->val != NULL) {
+      fprintf(outfile, "%s=%s\n", p->key, p->val);
+    } else {
+      if (ini->flags & INIO_ALLOW_EMPTY) {
+        fprintf(outfile, "%s=\n", p->key);
+      }
+    }
+  }
+
+  fprintf(outfile, "\n");
+
+  for (struct inisection* s = ini->head; s; s = s->next) {
+    if (s->head == NULL) {
+      continue;
+    } else {
+      fprintf(outfile, "[%s]\n", s->name);
+    }
+
+    for (struct inipair* p = s->head; p; p = p->next) {
+      if (p->val != NULL) {
+        fprintf(outfile, "%s=%s\n", p->key, p->val);
+      } else {
+        if (ini->flags & INIO_ALLOW_EMPTY) {
+          fprintf(outfile, "%s=\n", p->key);
+        }
+      }
+    }
+
+    fprintf(outfile, "\n");
+  }
+
+  fclose(outfile);
+
+  return 0;
+}
+
+char* pair_setval(struct inipair* pair, char* val) {
+  if (pair == NULL) {
+    return NULL;
+  }
+
+  if (pair->val != NULL) {
+    if (!(pair->borrowed & BORROWED_VAL)) {
+      free(pair->val);
+    }
+    pair->val = NULL;
+  }
+  pair->borrowed &= ~BORROWED_VAL;
+  pair->valtype = VAL_NONE;
+
+  if (val != NULL) {
+    pair->val = strdup(val);
+    if (pair->val == NULL) {
+      return NULL;
+    }
+    if (pair->section != NULL && pair->section->file != NULL) {
+      pair->section->file->heapowned = 1;
+    }
+  }
+
+  if (pair->section != NULL) {
+    subs_notify(pair->section, pair, INIC_CHANGED);
+  }
+  return pair->val;
+}
+
+struct inipair* ini_put(struct inifile* ini, char* section, char* key,
+                        char* val) {
+  if (ini == NULL || key == NULL) {
+    return NULL;
+  }
+
+  struct inisection* s = ini_getsection(ini, section);
+  if (s == NULL) {
+    s = section_insertnew(ini, ini_makesection(ini, section, strlen(section),
+                                               0));
+    if (s == NULL) {
+      return NULL;
+    }
+  }
+
+  struct inipair* p = inisection_getpair(s, key);
+  if (p == NULL) {
+    p = pair_insertnew(s, ini_makepair(ini, key, strlen(key), val,
+                                       val == NULL ? 0 : strlen(val), 0));
+  } else if (NULL == pair_setval(p, val) && val != NULL) {
+    return NULL;
+  }
+
+  return p;
+}
+
+struct inipair* ini_set(struct inifile* ini, char* section, char* key,
+                        char* val) {
+  if (ini == NULL || key == NULL) {
+    return NULL;
+  }
+
+  struct inisection* s = ini_getsection(ini, section);
+  if (s == NULL) {
+    return NULL;
+  }
+
+  struct inipair* p = inisection_getpair(s, key);
+  if (p == NULL) {
+    return NULL;
+  }
+
+  if (NULL == pair_setval(p, val)) {
+    return NULL;
+  }
+
+  return p;
+}
+
+// orders strings the same way strcmp() does, without needing terminators
+static int frozen_cmp(const char* a, size_t alen, const char* b,
+                      size_t blen) {
+  int s = memcmp(a, b, alen < blen ? alen : blen);
+  if (s != 0) {
+    return s;
+  }
+  return (alen > blen) - (alen < blen);
+}
+
+static const struct frozenheader* frozen_header(const struct inifrozen* fz) {
+  return (const struct frozenheader*)fz->base;
+}
+
+static const struct frozensection* frozen_sections(
+    const struct inifrozen* fz) {
+  return (const struct frozensection*)(fz->base + frozen_header(fz)->sections);
+}
+
+static const struct frozenpair* frozen_pairs(const struct inifrozen* fz) {
+  return (const struct frozenpair*)(fz->base + frozen_header(fz)->pairs);
+}
+
+// finds a section in a frozen file by name, NULL being the default section
+static const struct frozensection* frozen_getsection(
+    const struct inifrozen* fz, const char* name) {
+  const struct frozensection* secs = frozen_sections(fz);
+  if (name == NULL) {
+    return &secs[0];
+  }
+
+  size_t len = strlen(name);
+  size_t lo = 1;
+  size_t hi = frozen_header(fz)->nsections;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int s = frozen_cmp(name, len, fz->base + secs[mid].name,
+                       secs[mid].namelen);
+    if (s == 0) {
+      return &secs[mid];
+    } else if (s < 0) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+
+  return NULL;
+}
+
+// finds a pair in a section of a frozen file by key
+static const struct frozenpair* frozen_getpair(
+    const struct inifrozen* fz, const struct frozensection* sec,
+    const char* key) {
+  const struct frozenpair* pairs = frozen_pairs(fz) + sec->first;
+  size_t len = strlen(key);
+  size_t lo = 0;
+  size_t hi = sec->npairs;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int s = frozen_cmp(key, len, fz->base + pairs[mid].key,
+                       pairs[mid].keylen);
+    if (s == 0) {
+      return &pairs[mid];
+    } else if (s < 0) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+
+  return NULL;
+}
+
+// copies a string into a frozen block's pool, returning its offset
+static uint32_t frozen_putstr(char* base, size_t* used, const char* str,
+                              size_t len) {
+  uint32_t off = *used;
+  memcpy(base + off, str, len);
+  base[off + len] = '\0';
+  *used += len + 1;
+  return off;
+}
+
+// adds up the pairs and string space a section needs in a frozen block
+static void frozen_measure(struct inisection* sec, size_t* npairs,
+                           size_t* strings) {
+  *strings += (sec->name == NULL ? 0 : strlen(sec->name)) + 1;
+  for (struct inipair* p = sec->head; p; p = p->next) {
+    (*npairs)++;
+    *strings += strlen(p->key) + 1;
+    if (p->val != NULL) {
+      *strings += strlen(p->val) + 1;
+    }
+  }
+}
+
+// fills in the section and its pairs at the given index of a frozen block
+static void frozen_putsection(char* base, size_t* used, uint32_t* npairs,
+                              uint32_t i, struct inisection* sec) {
+  struct frozenheader* h = (struct frozenheader*)base;
+  struct frozensection* fs = (struct frozensection*)(base + h->sections) + i;
+  struct frozenpair* fp = (struct frozenpair*)(base + h->pairs);
+
+  if (sec->name != NULL) {
+    fs->namelen = strlen(sec->name);
+    fs->name = frozen_putstr(base, used, sec->name, fs->namelen);
+  } else {
+    fs->namelen = 0;
+    fs->name = frozen_putstr(base, used, "", 0);
+  }
+  fs->first = *npairs;
+  fs->npairs = 0;
+
+  for (struct inipair* p = sec->head; p; p = p->next) {
+    struct frozenpair* f = &fp[(*npairs)++];
+    f->keylen = strlen(p->key);
+    f->key = frozen_putstr(base, used, p->key, f->keylen);
+    if (p->val != NULL) {
+      f->vallen = strlen(p->val);
+      f->val = frozen_putstr(base, used, p->val, f->vallen);
+    } else {
+      f->vallen = 0;
+      f->val = FROZEN_NULL;
+    }
+    fs->npairs++;
+  }
+}
+
+struct inifrozen* ini_freeze(struct inifile* ini) {
+  if (ini == NULL) {
+    return NULL;
+  }
+
+  // first, work out how big everything is
+  size_t nsections = 1;
+  size_t npairs = 0;
+  size_t strings = 0;
+  frozen_measure(ini->default_section, &npairs, &strings);
+  for (struct inisection* s = ini->head; s; s = s->next) {
+    nsections++;
+    frozen_measure(s, &npairs, &strings);
+  }
+
+  size_t size = sizeof(struct frozenheader)
+                + nsections * sizeof(struct frozensection)
+                + npairs * sizeof(struct frozenpair) + strings;
+  if (size >= FROZEN_NULL) {
+    fprintf(stderr, "ini_freeze: file too large to freeze\n");
+    return NULL;
+  }
+
+  struct inifrozen* fz = malloc(sizeof(struct inifrozen));
+  char* base = calloc(1, size);
+  if (fz == NULL || base == NULL) {
+    perror("ini_freeze: calloc");
+    free(fz);
+    free(base);
+    return NULL;
+  }
+
+  struct frozenheader* h = (struct frozenheader*)base;
+  memcpy(h->magic, FROZEN_MAGIC, sizeof(h->magic));
+  h->version = FROZEN_VERSION;
+  h->nsections = nsections;
+  h->npairs = npairs;
+  h->sections = sizeof(struct frozenheader);
+  h->pairs = h->sections + nsections * sizeof(struct frozensection);
+  h->strings = h->pairs + npairs * sizeof(struct frozenpair);
+  h->size = size;
+
+  // then fill it in; the lists are already sorted
+  size_t used = h->strings;
+  uint32_t pairsused = 0;
+  uint32_t i = 0;
+  frozen_putsection(base, &used, &pairsused, i++, ini->default_section);
+  for (struct inisection* s = ini->head; s; s = s->next) {
+    frozen_putsection(base, &used, &pairsused, i++, s);
+  }
+
+  fz->base = base;
+  fz->size = size;
+  fz->kind = FROZEN_HEAP;
+  return fz;
+}
+
+const char* ini_frozen_get(const struct inifrozen* fz, const char* section,
+                           const char* key) {
+  if (fz == NULL || key == NULL) {
+    return NULL;
+  }
+
+  const struct frozensection* s = frozen_getsection(fz, section);
+  if (s == NULL) {
+    return NULL;
+  }
+
+  const struct frozenpair* p = frozen_getpair(fz, s, key);
+  if (p == NULL || p->val == FROZEN_NULL) {
+    return NULL;
+  }
+
+  return fz->base + p->val;
+}
+
+int ini_frozen_has(const struct inifrozen* fz, const char* section,
+                   const char* key) {
+  if (fz == NULL || key == NULL) {
+    return 0;
+  }
+
+  const struct frozensection* s = frozen_getsection(fz, section);
+  return s != NULL && frozen_getpair(fz, s, key) != NULL;
+}
+
+int ini_frozen_foreach(const struct inifrozen* fz, ini_pair_op_ex cb,
+                       void* userdata) {
+  if (fz == NULL || cb == NULL) {
+    return 1;
+  }
+
+  const struct frozenheader* h = frozen_header(fz);
+  const struct frozensection* secs = frozen_sections(fz);
+  const struct frozenpair* pairs = frozen_pairs(fz);
+
+  // the callback gets temporary structures pointing into the block
+  struct inisection sec = {0};
+  struct inipair pair = {0};
+  for (uint32_t i = 0; i < h->nsections; i++) {
+    sec.name = i == 0 ? NULL : (char*)fz->base + secs[i].name;
+    for (uint32_t j = secs[i].first; j < secs[i].first + secs[i].npairs;
+         j++) {
+      pair.key = (char*)fz->base + pairs[j].key;
+      pair.val = pairs[j].val == FROZEN_NULL
+                     ? NULL
+                     : (char*)fz->base + pairs[j].val;
+      int ret = cb(&sec, &pair, userdata);
+      if (ret) {
+        return ret;
+      }
+    }
+  }
+
+  return 0;
+}
+
+void ini_frozen_free(struct inifrozen* fz) {
+  if (fz == NULL) {
+    return;
+  }
+
+  if (fz->kind == FROZEN_MAPPED) {
+    munmap((void*)fz->base, fz->size);
+  } else {
+    free((char*)fz->base);
+  }
+  free(fz);
+}
+
+/*
+ * Checks that a block of size bytes is a frozen file which can be used
+ * safely: the header matches, the tables fit, and every offset stays in the
+ * string pool, which ends with a terminator. The strings themselves are not
+ * read. Returns 0 if it's fine, else 1.
+ */
+static int frozen_check(const char* base, size_t size) {
+  const struct frozenheader* h = (const struct frozenheader*)base;
+  if (size < sizeof(struct frozenheader)
+      || 0 != memcmp(h->magic, FROZEN_MAGIC, sizeof(h->magic))
+      || h->version != FROZEN_VERSION || h->size != size
+      || h->nsections == 0) {
+    return 1;
+  }
+
+  if (h->sections != sizeof(struct frozenheader)
+      || h->pairs != h->sections
+                     + (uint64_t)h->nsections * sizeof(struct frozensection)
+      || h->strings != h->pairs
+                       + (uint64_t)h->npairs * sizeof(struct frozenpair)
+      || h->strings >= size || base[size - 1] != '\0') {
+    return 1;
+  }
+
+  const struct frozensection* secs =
+      (const struct frozensection*)(base + h->sections);
+  const struct frozenpair* pairs =
+      (const struct frozenpair*)(base + h->pairs);
+  for (uint32_t i = 0; i < h->nsections; i++) {
+    if (secs[i].name < h->strings
+        || (uint64_t)secs[i].name + secs[i].namelen >= size
+        || (uint64_t)secs[i].first + secs[i].npairs > h->npairs) {
+      return 1;
+    }
+  }
+  for (uint32_t i = 0; i < h->npairs; i++) {
+    if (pairs[i].key < h->strings
+        || (uint64_t)pairs[i].key + pairs[i].keylen >= size) {
+      return 1;
+    }
+    if (pairs[i].val != FROZEN_NULL
+        && (pairs[i].val < h->strings
+            || (uint64_t)pairs[i].val + pairs[i].vallen >= size)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int ini_write_binary(struct inifile* ini, char* filename) {
+  if (ini == NULL || filename == NULL) {
+    return 1;
+  }
+
+  struct inifrozen* fz = ini_freeze(ini);
+  if (fz == NULL) {
+    return 1;
+  }
+
+  int ret = ini_frozen_write(fz, filename);
+  ini_frozen_free(fz);
+  return ret;
+}
+
+int ini_frozen_write(const struct inifrozen* fz, char* filename) {
+  if (fz == NULL || filename == NULL) {
+    return 1;
+  }
+
+  // written beside the real file and renamed over it, so anyone who has the
+  // old one mapped keeps seeing the old one intact
+  size_t len = strlen(filename);
+  char* tmpname = malloc(len + sizeof(".XXXXXX"));
+  if (tmpname == NULL) {
+    perror("ini_frozen_write: malloc");
+    return 1;
+  }
+  memcpy(tmpname, filename, len);
+  memcpy(tmpname + len, ".XXXXXX", sizeof(".XXXXXX"));
+
+  int fd = mkstemp(tmpname);
+  if (fd < 0) {
+    perror("ini_frozen_write: mkstemp");
+    free(tmpname);
+    return 1;
+  }
+
+  // mkstemp() makes the file readable only by its owner, so give it the mode
+  // of the file it replaces, or the one a new file would have
+  struct stat st;
+  mode_t mode;
+  if (stat(filename, &st) == 0) {
+    mode = st.st_mode & 07777;
+  } else {
+    mode_t mask = umask(0);
+    umask(mask);
+    mode = 0666 & ~mask;
+  }
+  if (fchmod(fd, mode) != 0) {
+    perror("ini_frozen_write: fchmod");
+    close(fd);
+    unlink(tmpname);
+    free(tmpname);
+    return 1;
+  }
+
+  FILE* outfile = fdopen(fd, "w");
+  if (outfile == NULL) {
+    perror("ini_frozen_write: fdopen");
+    close(fd);
+    unlink(tmpname);
+    free(tmpname);
+    return 1;
+  }
+
+  int ret = 0;
+  if (fwrite(fz->base, 1, fz->size, outfile) != fz->size) {
+    perror("ini_frozen_write: fwrite");
+    ret = 1;
+  }
+  // the data has to be on disk before the rename is, or a crash could leave
+  // an empty or partial file under the real name
+  if (ret == 0 && fflush(outfile) != 0) {
+    perror("ini_frozen_write: fflush");
+    ret = 1;
+  }
+  if (ret == 0 && fsync(fd) != 0) {
+    perror("ini_frozen_write: fsync");
+    ret = 1;
+  }
+  if (fclose(outfile) != 0) {
+    perror("ini_frozen_write: fclose");
+    ret = 1;
+  }
+  if (ret == 0 && rename(tmpname, filename) != 0) {
+    perror("ini_frozen_write: rename");
+    ret = 1;
+  }
+  if (ret != 0) {
+    unlink(tmpname);
+  }
+
+  free(tmpname);
+  return ret;
+}
+
+/*
+ * Maps a frozen file read-only from an open file descriptor, which is closed.
+ * What is the name to use in error messages.
+ * Returns NULL on error.
+ */
+static struct inifrozen* frozen_mapfd(int fd, const char* what) {
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    perror("frozen_mapfd: fstat");
+    close(fd);
+    return NULL;
+  }
+
+  size_t size = st.st_size;
+  if (size < sizeof(struct frozenheader)) {
+    fprintf(stderr, "%s: not a frozen INI file\n", what);
+    close(fd);
+    return NULL;
+  }
+
+  char* base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    perror("frozen_mapfd: mmap");
+    return NULL;
+  }
+
+  if (frozen_check(base, size)) {
+    fprintf(stderr, "%s: not a frozen INI file\n", what);
+    munmap(base, size);
+    return NULL;
+  }
+
+  struct inifrozen* fz = malloc(sizeof(struct inifrozen));
+  if (fz == NULL) {
+    perror("frozen_mapfd: malloc");
+    munmap(base, size);
+    return NULL;
+  }
+  fz->base = base;
+  fz->size = size;
+  fz->kind = FROZEN_MAPPED;
+  return fz;
+}
+
+struct inifrozen* ini_open_binary(char* filename) {
+  if (filename == NULL) {
+    return NULL;
+  }
+
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    perror("ini_open_binary: open");
+    return NULL;
+  }
+
+  return frozen_mapfd(fd, filename);
+}
+
+int ini_frozen_publish(const struct inifrozen* fz, const char* name) {
+  if (fz == NULL || name == NULL) {
+    return 1;
+  }
+
+  // anyone attached to an old image keeps it until they detach, and
+  // everyone who attaches from now on gets the new one
+  if (shm_unlink(name) != 0 && errno != ENOENT) {
+    perror("ini_frozen_publish: shm_unlink");
+    return 1;
+  }
+
+  // the umask applies, so the object gets the mode a new file would, as
+  // with ini_frozen_write(), and workers running as other users can attach
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0666);
+  if (fd < 0) {
+    perror("ini_frozen_publish: shm_open");
+    return 1;
+  }
+
+  if (ftruncate(fd, fz->size) != 0) {
+    perror("ini_frozen_publish: ftruncate");
+    close(fd);
+    shm_unlink(name);
+    return 1;
+  }
+
+  char* base = mmap(NULL, fz->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                    0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    perror("ini_frozen_publish: mmap");
+    shm_unlink(name);
+    return 1;
+  }
+
+  // the magic goes in last, so that anyone attaching while this is being
+  // copied sees an invalid image rather than half of one
+  size_t magic = sizeof(((struct frozenheader*)0)->magic);
+  memcpy(base + magic, fz->base + magic, fz->size - magic);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  memcpy(base, fz->base, magic);
+
+  munmap(base, fz->size);
+  return 0;
+}
+
+struct inifrozen* ini_frozen_attach(const char* name) {
+  if (name == NULL) {
+    return NULL;
+  }
+
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    perror("ini_frozen_attach: shm_open");
+    return NULL;
+  }
+
+  return frozen_mapfd(fd, name);
+}
+
+int ini_frozen_unpublish(const char* name) {
+  if (name == NULL) {
+    return 1;
+  }
+
+  if (shm_unlink(name) != 0) {
+    perror("ini_frozen_unpublish: shm_unlink");
+    return 1;
+  }
+  return 0;
+}
+
+struct inifile* ini_thaw(const struct inifrozen* fz, int flags) {
+  if (fz == NULL) {
+    return NULL;
+  }
+
+  struct inifile* ini = makeini(flags);
+  if (ini == NULL) {
+    return NULL;
+  }
+
+  const struct frozenheader* h = frozen_header(fz);
+  const struct frozensection* secs = frozen_sections(fz);
+  const struct frozenpair* pairs = frozen_pairs(fz);
+  for (uint32_t i = 0; i < h->nsections; i++) {
+    struct inisection* sec = ini->default_section;
+    if (i != 0) {
+      sec = section_insertnew(ini,
+                              ini_makesection(ini,
+                                              (char*)fz->base + secs[i].name,
+                                              secs[i].namelen, 0));
+      if (sec == NULL) {
+        freeini(ini);
+        return NULL;
+      }
+    }
+
+    for (uint32_t j = secs[i].first; j < secs[i].first + secs[i].npairs;
+         j++) {
+      char* val = NULL;
+      if (pairs[j].val != FROZEN_NULL) {
+        val = (char*)fz->base + pairs[j].val;
+      }
+      if (NULL == pair_insertnew(sec,
+                                 ini_makepair(ini,
+                                              (char*)fz->base + pairs[j].key,
+                                              pairs[j].keylen, val,
+                                              pairs[j].vallen, 0))) {
+        freeini(ini);
+        return NULL;
+      }
+    }
+  }
+
+  return ini;
+}
+
+/*
+ * The perfect hash written by ini_write_phash() works on a single 64-bit
+ * FNV-1a hash of the section name and key, mixed twice: the first mix picks
+ * a bucket, and each bucket has a displacement which is mixed back in to
+ * pick a distinct slot for everything in the bucket. These
+ * functions must match the ones written into the header exactly.
+ */
+
+// average number of entries per bucket
+#define PHASH_BUCKET_SIZE 4
+// displacements tried per bucket before giving up
+#define PHASH_MAX_TRIES (1u << 24)
+
+static uint64_t phash_fnv(uint64_t h, const char* str) {
+  for (const unsigned char* c = (const unsigned char*)str; *c; c++) {
+    h ^= *c;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+static uint64_t phash_mix(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+static uint64_t phash_hash(const char* section, const char* key) {
+  uint64_t h = 14695981039346656037ULL;
+  if (section != NULL) {
+    h = phash_fnv(h, section);
+    h = (h ^ 0xff) * 1099511628211ULL;
+  } else {
+    h = (h ^ 0xfe) * 1099511628211ULL;
+  }
+  return phash_mix(phash_fnv(h, key));
+}
+
+static uint32_t phash_slot(uint64_t x, uint32_t disp, uint32_t n) {
+  return phash_mix(x + (disp + 1ULL) * 0x9e3779b97f4a7c15ULL) % n;
+}
+
+struct phashentry {
+  struct inisection* sec;
+  struct inipair* pair;
+  uint64_t hash;
+  uint32_t bucket;
+};
+
+struct phashbucket {
+  uint32_t id;
+  uint32_t size;
+  // index of the first of its entries once they're sorted by bucket
+  uint32_t first;
+};
+
+static int phash_bybucket(const void* a, const void* b) {
+  const struct phashentry* x = a;
+  const struct phashentry* y = b;
+  return (x->bucket > y->bucket) - (x->bucket < y->bucket);
+}
+
+static int phash_bysize(const void* a, const void* b) {
+  const struct phashbucket* x = a;
+  const struct phashbucket* y = b;
+  return (x->size < y->size) - (x->size > y->size);
+}
+
+/*
+ * Finds a displacement for every bucket so that every entry gets its own
+ * slot, filling in slots with the entry in each. Returns 0 on success, else 1.
+ */
+static int phash_build(struct phashentry* entries, uint32_t n,
+                       uint32_t nbuckets, uint32_t* disp, uint32_t* slots) {
+  struct phashbucket* buckets = calloc(nbuckets, sizeof(struct phashbucket));
+  uint32_t* tried = malloc(PHASH_BUCKET_SIZE * 4 * sizeof(uint32_t));
+  if (buckets == NULL || tried == NULL) {
+    perror("phash_build: calloc");
+    free(buckets);
+    free(tried);
+    return 1;
+  }
+
+  qsort(entries, n, sizeof(struct phashentry), phash_bybucket);
+  for (uint32_t i = 0; i < nbuckets; i++) {
+    buckets[i].id = i;
+  }
+  for (uint32_t i = n; i-- > 0;) {
+    buckets[entries[i].bucket].size++;
+    buckets[entries[i].bucket].first = i;
+  }
+  // the biggest buckets are the hardest to place, so they go first
+  qsort(buckets, nbuckets, sizeof(struct phashbucket), phash_bysize);
+
+  for (uint32_t i = 0; i < n; i++) {
+    slots[i] = UINT32_MAX;
+  }
+
+  int ret = 0;
+  size_t triedcap = PHASH_BUCKET_SIZE * 4;
+  for (uint32_t b = 0; b < nbuckets && buckets[b].size != 0 && ret == 0;
+       b++) {
+    struct phashbucket* bk = &buckets[b];
+    if (bk->size > triedcap) {
+      uint32_t* t = realloc(tried, bk->size * sizeof(uint32_t));
+      if (t == NULL) {
+        perror("phash_build: realloc");
+        ret = 1;
+        break;
+      }
+      tried = t;
+      triedcap = bk->size;
+    }
+
+    uint32_t d;
+    for (d = 0; d < PHASH_MAX_TRIES; d++) {
+      uint32_t placed = 0;
+      for (; placed < bk->size; placed++) {
+        uint32_t slot = phash_slot(entries[bk->first + placed].hash, d, n);
+        if (slots[slot] != UINT32_MAX) {
+          break;
+        }
+        slots[slot] = bk->first + placed;
+        tried[placed] = slot;
+      }
+      if (placed == bk->size) {
+        break;
+      }
+      // undo the partial placement and try the next displacement
+      while (placed-- > 0) {
+        slots[tried[placed]] = UINT32_MAX;
+      }
+    }
+
+    if (d == PHASH_MAX_TRIES) {
+      fprintf(stderr, "phash_build: no perfect hash found\n");
+      ret = 1;
+    }
+    disp[bk->id] = d;
+  }
+
+  free(buckets);
+  free(tried);
+  return ret;
+}
+
+// writes a string as a C string literal
+static void phash_putstr(FILE* out, const char* str) {
+  fputc('"', out);
+  for (const unsigned char* c = (const unsigned char*)str; *c; c++) {
+    if (*c == '"' || *c == '\\') {
+      fprintf(out, "\\%c", *c);
+    } else if (isprint(*c)) {
+      fputc(*c, out);
+    } else {
+      fprintf(out, "\\%03o", *c);
+    }
+  }
+  fputc('"', out);
+}
+
+// copies a name into part of an identifier, in upper case
+static char* phash_putident(char* out, const char* name) {
+  for (const unsigned char* c = (const unsigned char*)name; *c; c++) {
+    *out++ = isalnum(*c) ? toupper(*c) : '_';
+  }
+  return out;
+}
+
+// makes the enum name for an entry, as PREFIX_SECTION__KEY or PREFIX_KEY
+static char* phash_enumname(const char* upper, struct phashentry* e) {
+  size_t len = strlen(upper) + strlen(e->pair->key) + 4;
+  if (e->sec->name != NULL) {
+    len += strlen(e->sec->name);
+  }
+
+  char* name = malloc(len);
+  if (name == NULL) {
+    perror("phash_enumname: malloc");
+    return NULL;
+  }
+  char* c = stpcpy(name, upper);
+  *c++ = '_';
+  if (e->sec->name != NULL) {
+    c = phash_putident(c, e->sec->name);
+    *c++ = '_';
+    *c++ = '_';
+  }
+  *phash_putident(c, e->pair->key) = '\0';
+  return name;
+}
+
+static int phash_byname(const void* a, const void* b) {
+  return strcmp(**(char***)a, **(char***)b);
+}
+
+// returns whether an enum name is one the header uses for something else
+static int phash_reserved(const char* upper, const char* name) {
+  size_t len = strlen(upper);
+  return 0 == strncmp(name, upper, len)
+         && (0 == strcmp(name + len, "_COUNT")
+             || 0 == strcmp(name + len, "_PHASH_H_"));
 }
 
-void freeini(struct inifile* ini) {
-  if (ini == NULL) {
-    return;
+// returns whether an enum name is reserved or already in the index
+static int phash_taken(const char* upper, struct iniindex* taken,
+                       const char* name) {
+  size_t len = strlen(name);
+  return phash_reserved(upper, name)
+         || NULL != index_lookup(taken, name, len, strhash(name, len),
+                                 string_match);
+}
+
+/*
+ * Makes the enum names for every slot. Different names can turn into the
+ * same identifier, or into one of the header's own macros, so any that do get
+ * their slot number added on the end, and then a count as well if that's
+ * still taken. Returns NULL on failure.
+ */
+static char** phash_enumnames(const char* upper, struct phashentry* entries,
+                              uint32_t n, const uint32_t* slots) {
+  char** names = calloc(n, sizeof(char*));
+  char*** sorted = calloc(n, sizeof(char**));
+  unsigned char* clash = calloc(n, 1);
+  struct iniindex taken = {0};
+  if (names == NULL || sorted == NULL || clash == NULL) {
+    perror("phash_enumnames: calloc");
+    goto fail;
   }
 
-  freesec_r(ini->default_section);
-  freesec_r(ini->head);
-  free(ini);
-}
+  for (uint32_t i = 0; i < n; i++) {
+    names[i] = phash_enumname(upper, &entries[slots[i]]);
+    if (names[i] == NULL) {
+      goto fail;
+    }
+    sorted[i] = &names[i];
+    clash[i] = phash_reserved(upper, names[i]);
+  }
 
-struct inisection* section_insert(struct inifile* file, struct inisection* sec) {
-  if (file == NULL || sec == NULL) {
-    return NULL;
+  qsort(sorted, n, sizeof(char**), phash_byname);
+  for (uint32_t i = 0; i < n;) {
+    uint32_t j = i + 1;
+    while (j < n && 0 == strcmp(*sorted[i], *sorted[j])) {
+      j++;
+    }
+    for (uint32_t k = i; j - i > 1 && k < j; k++) {
+      clash[sorted[k] - names] = 1;
+    }
+    i = j;
   }
 
-  if (file->head == NULL) {
-    file->head = sec;
-    sec->next = NULL;
-    return sec;
-  } else {
-    struct inisection* prev = NULL;
-    struct inisection* curr = file->head;
-    int s;
-    while (curr->next != NULL) {
-      s = strcmp(sec->name, curr->name);
-      if (s < 0) { // less than
-        if (prev == NULL) {
-          sec->next = file->head;
-          file->head = sec;
-          return sec;
-        } else {
-          prev->next = sec;
-          sec->next = curr;
-          return sec;
-        }
-      } else if (s == 0) { // equal to
-        return curr;
+  // every name which is kept as it is has to stay free
+  for (uint32_t i = 0; i < n; i++) {
+    if (!clash[i]) {
+      if (index_reserve(&taken, NULL)) {
+        goto fail;
       }
+      index_add(&taken, names[i], strhash(names[i], strlen(names[i])));
+    }
+  }
 
-      prev = curr;
-      curr = curr->next;
+  for (uint32_t i = 0; i < n; i++) {
+    if (!clash[i]) {
+      continue;
+    }
+    size_t len = strlen(names[i]);
+    char* name = malloc(len + 24);
+    if (name == NULL) {
+      perror("phash_enumnames: malloc");
+      goto fail;
     }
+    if (index_reserve(&taken, NULL)) {
+      free(name);
+      goto fail;
+    }
+    sprintf(name, "%s_%u", names[i], i);
+    for (unsigned k = 2; phash_taken(upper, &taken, name); k++) {
+      sprintf(name, "%s_%u_%u", names[i], i, k);
+    }
+    free(names[i]);
+    names[i] = name;
+    index_add(&taken, name, strhash(name, strlen(name)));
+  }
 
-    curr->next = sec;
-    sec->next = NULL;
-    return sec;
+  index_free(&taken);
+  free(clash);
+  free(sorted);
+  return names;
+
+fail:
+  for (uint32_t i = 0; names != NULL && i < n; i++) {
+    free(names[i]);
   }
+  index_free(&taken);
+  free(names);
+  free(clash);
+  free(sorted);
+  return NULL;
 }
 
-struct inipair* pair_insert(struct inisection* sec, struct inipair* pair) {
-  if (sec == NULL || pair == NULL) {
-    return NULL;
-  }
+static void phash_write(FILE* out, const char* prefix, const char* upper,
+                        struct phashentry* entries, char** names, uint32_t n,
+                        uint32_t nbuckets, const uint32_t* disp,
+                        const uint32_t* slots) {
+  fprintf(out, "/*\n * Generated by ini_write_phash(), do not edit.\n");
+  fprintf(out, " * Minimal perfect hash over %u section/key names.\n */\n\n",
+          n);
+  fprintf(out, "#ifndef %s_PHASH_H_\n#define %s_PHASH_H_\n\n", upper, upper);
+  fprintf(out, "#include <stdint.h>\n#include <string.h>\n\n");
+  fprintf(out, "#include \"ini.h\"\n\n");
+  fprintf(out, "#define %s_COUNT %u\n\n", upper, n);
 
-  if (sec->head == NULL) {
-    sec->head = pair;
-    sec->head->next = NULL;
-    return sec->head;
-  } else {
-    struct inipair* prev = NULL;
-    struct inipair* curr = sec->head;
-    int s;
-    while (curr->next != NULL) {
-      s = strcmp(pair->key, curr->key);
-      if (s < 0) { // less than (insert before)
-        if (prev == NULL) {
-          sec->head = pair;
-          pair->next = curr;
-          return sec->head;
-        } else {
-          prev->next = pair;
-          pair->next = curr;
-          return pair;
-        }
-      } else if (s == 0) { // equal to (overwrite)
-        if (prev == NULL) {
-          sec->head = pair;
-          pair->next = curr->next;
-        } else {
-          prev->next = pair;
-          pair->next = curr->next;
-        }
-        freepair(curr);
-        return pair;
-      }
+  fprintf(out, "enum {\n");
+  for (uint32_t i = 0; i < n; i++) {
+    fprintf(out, "  %s = %u,\n", names[i], i);
+  }
+  fprintf(out, "};\n\n");
 
-      prev = curr;
-      curr = curr->next;
+  fprintf(out, "static const char* const %s_sections[%u] = {\n", prefix, n);
+  for (uint32_t i = 0; i < n; i++) {
+    fputs("  ", out);
+    if (entries[slots[i]].sec->name == NULL) {
+      fputs("NULL", out);
+    } else {
+      phash_putstr(out, entries[slots[i]].sec->name);
     }
+    fputs(",\n", out);
+  }
+  fprintf(out, "};\n\n");
 
-    curr->next = pair;
-    pair->next = NULL;
-    return pair;
+  fprintf(out, "static const char* const %s_keys[%u] = {\n", prefix, n);
+  for (uint32_t i = 0; i < n; i++) {
+    fputs("  ", out);
+    phash_putstr(out, entries[slots[i]].pair->key);
+    fputs(",\n", out);
+  }
+  fprintf(out, "};\n\n");
+
+  fprintf(out, "static const uint32_t %s_disp[%u] = {", prefix, nbuckets);
+  for (uint32_t i = 0; i < nbuckets; i++) {
+    fprintf(out, "%s%u,", i % 8 == 0 ? "\n  " : " ", disp[i]);
   }
+  fprintf(out, "\n};\n\n");
+
+  fprintf(out,
+          "static inline uint64_t %s_fnv(uint64_t h, const char* str) {\n"
+          "  for (const unsigned char* c = (const unsigned char*)str; *c; "
+          "c++) {\n"
+          "    h ^= *c;\n"
+          "    h *= 1099511628211ULL;\n"
+          "  }\n"
+          "  return h;\n"
+          "}\n\n", prefix);
+  fprintf(out,
+          "static inline uint64_t %s_mix(uint64_t x) {\n"
+          "  x ^= x >> 33;\n"
+          "  x *= 0xff51afd7ed558ccdULL;\n"
+          "  x ^= x >> 33;\n"
+          "  x *= 0xc4ceb9fe1a85ec53ULL;\n"
+          "  x ^= x >> 33;\n"
+          "  return x;\n"
+          "}\n\n", prefix);
+  fprintf(out,
+          "/*\n"
+          " * Returns the slot for the given key in the given section (NULL\n"
+          " * for the default section), or -1 if it is not one of the names\n"
+          " * this was generated from.\n"
+          " */\n"
+          "static inline long %s_index(const char* section, const char* key) "
+          "{\n"
+          "  uint64_t h = 14695981039346656037ULL;\n"
+          "  if (section != NULL) {\n"
+          "    h = %s_fnv(h, section);\n"
+          "    h = (h ^ 0xff) * 1099511628211ULL;\n"
+          "  } else {\n"
+          "    h = (h ^ 0xfe) * 1099511628211ULL;\n"
+          "  }\n"
+          "  uint64_t x = %s_mix(%s_fnv(h, key));\n"
+          "  uint64_t d = %s_disp[(uint32_t)x %% %uu];\n"
+          "  uint32_t i = %s_mix(x + (d + 1) * 0x9e3779b97f4a7c15ULL) %% %uu;\n"
+          "  const char* s = %s_sections[i];\n"
+          "  if ((section == NULL) != (s == NULL)\n"
+          "      || (s != NULL && 0 != strcmp(section, s))\n"
+          "      || 0 != strcmp(key, %s_keys[i])) {\n"
+          "    return -1;\n"
+          "  }\n"
+          "  return i;\n"
+          "}\n\n",
+          prefix, prefix, prefix, prefix, prefix, nbuckets, prefix, n, prefix,
+          prefix);
+  fprintf(out,
+          "/*\n"
+          " * Looks up the pair for every slot in an INI file, so that\n"
+          " * slots[i] is the pair for slot i, or NULL if it is missing.\n"
+          " */\n"
+          "static inline void %s_bind(struct inifile* ini,\n"
+          "                           struct inipair* slots[%s_COUNT]) {\n"
+          "  for (uint32_t i = 0; i < %s_COUNT; i++) {\n"
+          "    slots[i] = ini_getpair(ini, (char*)%s_sections[i],\n"
+          "                           (char*)%s_keys[i]);\n"
+          "  }\n"
+          "}\n\n",
+          prefix, upper, upper, prefix, prefix);
+  fprintf(out, "#endif // %s_PHASH_H_\n", upper);
 }
 
-int loadinifromfile(struct inifile* inif, char* filename) {
-  if (inif == NULL || filename == NULL || inif->default_section == NULL) {
+int ini_write_phash(struct inifile* ini, char* filename, char* prefix) {
+  if (ini == NULL || filename == NULL || prefix == NULL) {
     return 1;
   }
 
-  FILE* infile = fopen(filename, "r");
-  if (NULL == infile) {
-    perror("loadinifromfile: fopen");
+  // the prefix starts every identifier in the header
+  if (!isalpha((unsigned char)prefix[0]) && prefix[0] != '_') {
+    fprintf(stderr, "ini_write_phash: bad prefix \"%s\"\n", prefix);
     return 1;
   }
-
-  const char* keyvalfmt;
-  if (inif->flags & INIO_SPACE_AROUND_DELIM) {
-    keyvalfmt = fmt_spaces;
-  } else {
-    keyvalfmt = fmt_no_spaces;
+  for (const char* c = prefix; *c; c++) {
+    if (!isalnum((unsigned char)*c) && *c != '_') {
+      fprintf(stderr, "ini_write_phash: bad prefix \"%s\"\n", prefix);
+      return 1;
+    }
   }
 
-  char tmpline[512] = {0};
-  char tmpkey[256] = {0};
-  char tmpval[256] = {0};
-  char tmpsection[256] = {0};
+  size_t n = 0;
+  for (struct inipair* p = ini->default_section->head; p; p = p->next) {
+    n++;
+  }
+  for (struct inisection* s = ini->head; s; s = s->next) {
+    for (struct inipair* p = s->head; p; p = p->next) {
+      n++;
+    }
+  }
+  if (n == 0 || n >= UINT32_MAX) {
+    fprintf(stderr, "ini_write_phash: nothing to hash\n");
+    return 1;
+  }
 
-  // default to inserting to the default section
-  struct inisection* tmpsec = inif->default_section;
+  uint32_t nbuckets = (n + PHASH_BUCKET_SIZE - 1) / PHASH_BUCKET_SIZE;
+  struct phashentry* entries = calloc(n, sizeof(struct phashentry));
+  uint32_t* disp = calloc(nbuckets, sizeof(uint32_t));
+  uint32_t* slots = calloc(n, sizeof(uint32_t));
+  char* upper = strdup(prefix);
+  if (entries == NULL || disp == NULL || slots == NULL || upper == NULL) {
+    perror("ini_write_phash: calloc");
+    free(entries);
+    free(disp);
+    free(slots);
+    free(upper);
+    return 1;
+  }
+  for (char* c = upper; *c; c++) {
+    *c = toupper((unsigned char)*c);
+  }
 
-  while (!feof(infile) && !ferror(infile)) {
-    if (tmpline != fgets(tmpline, 512, infile)) {
-      continue;
+  size_t i = 0;
+  for (struct inisection* s = ini->default_section; s;
+       s = s == ini->default_section ? ini->head : s->next) {
+    for (struct inipair* p = s->head; p; p = p->next, i++) {
+      entries[i].sec = s;
+      entries[i].pair = p;
+      entries[i].hash = phash_hash(s->name, p->key);
+      entries[i].bucket = (uint32_t)entries[i].hash % nbuckets;
     }
+  }
 
-    if (sscanf(tmpline, " [%256[^]]]", tmpsection) == 1) {
-      // set the current section
-      tmpsec = makesection(tmpsection);
-      struct inisection* tmpsec2 = section_insert(inif, tmpsec);
-      if (tmpsec2 != tmpsec) {
-        free(tmpsec);
-        tmpsec = tmpsec2;
+  char** names = NULL;
+  int ret = phash_build(entries, n, nbuckets, disp, slots);
+  if (ret == 0) {
+    names = phash_enumnames(upper, entries, n, slots);
+    ret = names == NULL;
+  }
+  if (ret == 0) {
+    FILE* outfile = fopen(filename, "w");
+    if (outfile == NULL) {
+      perror("ini_write_phash: fopen");
+      ret = 1;
+    } else {
+      phash_write(outfile, prefix, upper, entries, names, n, nbuckets, disp,
+                  slots);
+      if (fclose(outfile) != 0) {
+        perror("ini_write_phash: fclose");
+        ret = 1;
       }
-      continue;
     }
+  }
 
-    // check for both a key and a value
-    if (sscanf(tmpline, keyvalfmt, tmpkey, tmpval) == 2) {
-      // insert the new key/value pair into the current section
-      pair_insert(tmpsec, makepair(tmpkey, tmpval));
-      continue;
+  for (uint32_t j = 0; names != NULL && j < n; j++) {
+    free(names[j]);
+  }
+  free(names);
+  free(entries);
+  free(disp);
+  free(slots);
+  free(upper);
+  return ret;
+}
+
+/*
+ * Handles use epochs to tell when replaced files are safe to free. The
+ * handle's epoch goes up every time a file is replaced, and a locked reader
+ * records the epoch it saw before loading the current file. A file replaced
+ * going into epoch e can only be in use by readers which recorded an epoch
+ * before e, so it can be freed once there are none left. Every atomic here
+ * is sequentially consistent, so that a reader's epoch is visible before it
+ * loads the file, and a replaced file is swapped out before the epoch moves.
+ */
+
+// a reader's epoch when it isn't locked; handle epochs start above this
+#define EPOCH_IDLE 0
+
+// a replaced file waiting to be freed
+struct iniretired {
+  struct iniretired* next;
+  struct inifile* ini;
+  // the epoch the file was replaced going into
+  unsigned long epoch;
+};
+
+struct inihandle {
+  struct inifile* current;
+  unsigned long epoch;
+  // held by writers, and while readers are added or removed
+  pthread_mutex_t lock;
+  struct inireader* readers;
+  struct iniretired* retired;
+};
+
+struct inireader {
+  unsigned long epoch;
+  struct inihandle* h;
+  struct inireader* next;
+  // keeps readers' epochs out of each other's cache lines
+  char pad[64];
+};
+
+// frees replaced files no reader can still be using; h->lock must be held
+static void handle_reclaim(struct inihandle* h) {
+  unsigned long oldest = __atomic_load_n(&h->epoch, __ATOMIC_SEQ_CST);
+  for (struct inireader* r = h->readers; r; r = r->next) {
+    unsigned long e = __atomic_load_n(&r->epoch, __ATOMIC_SEQ_CST);
+    if (e != EPOCH_IDLE && e < oldest) {
+      oldest = e;
     }
+  }
 
-    // check for a key with no value
-    if (inif->flags & INIO_ALLOW_EMPTY) {
-      if (sscanf(tmpline, " %256[^=; ] \n", tmpkey) == 1) {
-        pair_insert(tmpsec, makepair(tmpkey, NULL));
-        continue;
-      }
+  struct iniretired** link = &h->retired;
+  while (*link != NULL) {
+    struct iniretired* old = *link;
+    if (old->epoch <= oldest) {
+      *link = old->next;
+      freeini(old->ini);
+      free(old);
+    } else {
+      link = &old->next;
     }
   }
+}
 
-  fclose(infile);
+struct inihandle* ini_handle_new(struct inifile* ini) {
+  if (ini == NULL) {
+    return NULL;
+  }
 
-  return 0;
+  struct inihandle* h = calloc(1, sizeof(struct inihandle));
+  if (h == NULL) {
+    perror("ini_handle_new: calloc");
+    return NULL;
+  }
+  if (pthread_mutex_init(&h->lock, NULL) != 0) {
+    fprintf(stderr, "ini_handle_new: pthread_mutex_init failed\n");
+    free(h);
+    return NULL;
+  }
+  h->current = ini;
+  h->epoch = EPOCH_IDLE + 1;
+  return h;
 }
 
-struct inifile* newinifromfile(char* filename, int flags) {
-  if (filename == NULL) {
+struct inireader* ini_handle_reader(struct inihandle* h) {
+  if (h == NULL) {
     return NULL;
   }
 
-  struct inifile* inif = makeini(flags);
-  if (inif == NULL) {
+  struct inireader* r = calloc(1, sizeof(struct inireader));
+  if (r == NULL) {
+    perror("ini_handle_reader: calloc");
     return NULL;
   }
+  r->h = h;
+  r->epoch = EPOCH_IDLE;
 
-  if (1 == loadinifromfile(inif, filename)) {
-    freeini(inif);
+  pthread_mutex_lock(&h->lock);
+  r->next = h->readers;
+  h->readers = r;
+  pthread_mutex_unlock(&h->lock);
+  return r;
+}
+
+struct inifile* ini_reader_lock(struct inireader* r) {
+  if (r == NULL) {
     return NULL;
   }
 
-  return inif;
+  struct inihandle* h = r->h;
+  __atomic_store_n(&r->epoch, __atomic_load_n(&h->epoch, __ATOMIC_SEQ_CST),
+                   __ATOMIC_SEQ_CST);
+  return __atomic_load_n(&h->current, __ATOMIC_SEQ_CST);
 }
 
-void parseini(struct inifile* ini, ini_pair_op cb) {
-  ini_foreach(ini, cb);
+void ini_reader_unlock(struct inireader* r) {
+  if (r != NULL) {
+    __atomic_store_n(&r->epoch, EPOCH_IDLE, __ATOMIC_RELEASE);
+  }
 }
 
-void ini_foreach(struct inifile* ini, ini_pair_op cb) {
-  for (struct inipair* p = ini->default_section->head; p; p = p->next) {
-    cb(ini->default_section, p);
+void ini_reader_free(struct inireader* r) {
+  if (r == NULL) {
+    return;
   }
 
-  for (struct inisection* s = ini->head; s; s = s->next) {
-    for (struct inipair* p = s->head; p; p = p->next) {
-      cb(s, p);
-    }
+  struct inihandle* h = r->h;
+  pthread_mutex_lock(&h->lock);
+  struct inireader** link = &h->readers;
+  while (*link != r) {
+    link = &(*link)->next;
   }
+  *link = r->next;
+  pthread_mutex_unlock(&h->lock);
+  free(r);
 }
 
-struct inisection* ini_getsection(struct inifile* ini, char* name) {
-  if (ini == NULL) {
-    return NULL;
+int ini_handle_publish(struct inihandle* h, struct inifile* ini) {
+  if (h == NULL || ini == NULL) {
+    return 1;
   }
 
-  if (name == NULL) {
-    return ini->default_section;
+  struct iniretired* old = malloc(sizeof(struct iniretired));
+  if (old == NULL) {
+    perror("ini_handle_publish: malloc");
+    return 1;
   }
 
-  for (struct inisection* s = ini->head; s; s = s->next) {
-    if (0 == strcmp(name, s->name)) {
-      return s;
-    }
+  pthread_mutex_lock(&h->lock);
+  old->ini = __atomic_exchange_n(&h->current, ini, __ATOMIC_SEQ_CST);
+  old->epoch = __atomic_add_fetch(&h->epoch, 1, __ATOMIC_SEQ_CST);
+  old->next = h->retired;
+  h->retired = old;
+  handle_reclaim(h);
+  pthread_mutex_unlock(&h->lock);
+  return 0;
+}
+
+int ini_handle_reload(struct inihandle* h, char* filename, int flags) {
+  if (h == NULL || filename == NULL) {
+    return 1;
   }
 
-  return NULL;
+  struct inifile* ini = newinifromfile(filename, flags);
+  if (ini == NULL) {
+    return 1;
+  }
+  if (ini_handle_publish(h, ini)) {
+    freeini(ini);
+    return 1;
+  }
+  return 0;
 }
 
-struct inipair* inisection_getpair(struct inisection* section, char* key) {
-  if (section == NULL || key == NULL) {
-    return NULL;
+void ini_handle_reclaim(struct inihandle* h) {
+  if (h != NULL) {
+    pthread_mutex_lock(&h->lock);
+    handle_reclaim(h);
+    pthread_mutex_unlock(&h->lock);
   }
+}
 
-  for (struct inipair* p = section->head; p; p = p->next) {
-    if (0 == strcmp(key, p->key)) {
-      return p;
-    }
+void ini_handle_free(struct inihandle* h) {
+  if (h == NULL) {
+    return;
   }
 
-  return NULL;
+  while (h->retired != NULL) {
+    struct iniretired* next = h->retired->next;
+    freeini(h->retired->ini);
+    free(h->retired);
+    h->retired = next;
+  }
+  while (h->readers != NULL) {
+    struct inireader* next = h->readers->next;
+    free(h->readers);
+    h->readers = next;
+  }
+  freeini(h->current);
+  pthread_mutex_destroy(&h->lock);
+  free(h);
 }
 
-struct inipair* ini_getpair(struct inifile* ini, char* section, char* key) {
-  struct inisection* s = ini_getsection(ini, section);
-  if (s == NULL) {
-    return NULL;
-  }
+#ifdef __linux__
 
-  return inisection_getpair(s, key);
+// what to watch a watched file's directory for
+#define WATCH_MASK \
+  (IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO)
+
+// a file being watched
+struct iniwatch {
+  struct iniwatch* next;
+  // the name it was added with, and the part of it after the directory
+  char* filename;
+  const char* base;
+  // watch descriptor of its directory
+  int wd;
+  int flags;
+  ini_watch_op cb;
+  void* userdata;
+  // whether it has changed and is waiting to be loaded, and when to load it
+  int pending;
+  long long due;
+};
+
+struct iniwatcher {
+  int inotify;
+  int epoll;
+  // written to stop the thread
+  int stop;
+  int debounce_ms;
+  pthread_t thread;
+  // held while the list of watches is changed or searched
+  pthread_mutex_t lock;
+  struct iniwatch* watches;
+};
+
+static long long watch_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
 }
 
-int writeinitofile(struct inifile* ini, char* filename) {
-  if (ini == NULL || filename == NULL) {
-    return 1;
+// marks watches as changed, either any in the directory wd named name, or
+// all of them if name is NULL
+static void watch_changed(struct iniwatcher* w, int wd, const char* name) {
+  long long due = watch_now() + w->debounce_ms;
+  pthread_mutex_lock(&w->lock);
+  for (struct iniwatch* iw = w->watches; iw; iw = iw->next) {
+    if (name == NULL || (iw->wd == wd && 0 == strcmp(iw->base, name))) {
+      iw->pending = 1;
+      iw->due = due;
+    }
   }
+  pthread_mutex_unlock(&w->lock);
+}
 
-  FILE* outfile = fopen(filename, "w");
-  if (outfile == NULL) {
-    perror("writeinitofile: fopen");
-    return 1;
-  }
+// reads everything inotify has to say
+static void watch_read(struct iniwatcher* w) {
+  char buf[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  for (;;) {
+    ssize_t len = read(w->inotify, buf, sizeof(buf));
+    if (len <= 0) {
+      return;
+    }
 
-  for (struct inipair* p = ini->default_section->head; p; p = p->next) {
-    if (p->val != NULL) {
-      fprintf(outfile, "%s=%s\n", p->key, p->val);
-    } else {
-      if (ini->flags & INIO_ALLOW_EMPTY) {
-        fprintf(outfile, "%s=\n", p->key);
+    for (char* c = buf; c < buf + len;) {
+      struct inotify_event* ev = (struct inotify_event*)c;
+      if (ev->mask & IN_Q_OVERFLOW) {
+        // some events were lost, so any file could have changed
+        watch_changed(w, -1, NULL);
+      } else if (ev->len != 0) {
+        watch_changed(w, ev->wd, ev->name);
       }
+      c += sizeof(struct inotify_event) + ev->len;
     }
   }
+}
 
-  fprintf(outfile, "\n");
+/*
+ * Loads every watch whose wait is over and passes it to its callback.
+ * Returns how long until the next one is due in milliseconds, or -1 if none
+ * are waiting.
+ */
+static int watch_load(struct iniwatcher* w) {
+  long long now = watch_now();
+  long long next = -1;
 
-  for (struct inisection* s = ini->head; s; s = s->next) {
-    if (s->head == NULL) {
-      continue;
-    } else {
-      fprintf(outfile, "[%s]\n", s->name);
+  pthread_mutex_lock(&w->lock);
+  struct iniwatch* iw = w->watches;
+  pthread_mutex_unlock(&w->lock);
+  // watches are only ever added to the head of the list, and not freed until
+  // the thread is done, so the rest of the list can be walked without the
+  // lock; pending and due are only touched with it held
+  for (; iw; iw = iw->next) {
+    pthread_mutex_lock(&w->lock);
+    int ready = iw->pending && iw->due <= now;
+    if (ready) {
+      iw->pending = 0;
+    } else if (iw->pending && (next < 0 || iw->due - now < next)) {
+      next = iw->due - now;
     }
+    pthread_mutex_unlock(&w->lock);
 
-    for (struct inipair* p = s->head; p; p = p->next) {
-      if (p->val != NULL) {
-        fprintf(outfile, "%s=%s\n", p->key, p->val);
-      } else {
-        if (ini->flags & INIO_ALLOW_EMPTY) {
-          fprintf(outfile, "%s=\n", p->key);
-        }
+    if (ready) {
+      struct inifile* ini = newinifromfile(iw->filename, iw->flags);
+      if (ini != NULL) {
+        iw->cb(iw->filename, ini, iw->userdata);
       }
     }
-
-    fprintf(outfile, "\n");
   }
+  return (int)next;
+}
 
-  fclose(outfile);
+static void* watch_thread(void* arg) {
+  struct iniwatcher* w = arg;
+  int timeout = -1;
+  for (;;) {
+    struct epoll_event evs[2];
+    int n = epoll_wait(w->epoll, evs, 2, timeout);
+    if (n < 0 && errno != EINTR) {
+      perror("watch_thread: epoll_wait");
+      return NULL;
+    }
 
-  return 0;
+    for (int i = 0; i < n; i++) {
+      if (evs[i].data.fd == w->stop) {
+        return NULL;
+      }
+      watch_read(w);
+    }
+    timeout = watch_load(w);
+  }
 }
 
-char* pair_setval(struct inipair* pair, char* val) {
-  if (pair == NULL) {
+struct iniwatcher* ini_watcher_new(int debounce_ms) {
+  struct iniwatcher* w = calloc(1, sizeof(struct iniwatcher));
+  if (w == NULL) {
+    perror("ini_watcher_new: calloc");
     return NULL;
   }
+  w->debounce_ms = debounce_ms < 0 ? 0 : debounce_ms;
+  w->epoll = -1;
+  w->stop = -1;
+  w->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (w->inotify < 0) {
+    perror("ini_watcher_new: inotify_init1");
+    goto fail;
+  }
+  w->epoll = epoll_create1(EPOLL_CLOEXEC);
+  if (w->epoll < 0) {
+    perror("ini_watcher_new: epoll_create1");
+    goto fail;
+  }
+  w->stop = eventfd(0, EFD_CLOEXEC);
+  if (w->stop < 0) {
+    perror("ini_watcher_new: eventfd");
+    goto fail;
+  }
 
-  if (pair->val != NULL) {
-    free(pair->val);
-    pair->val = NULL;
+  struct epoll_event ev = {.events = EPOLLIN};
+  ev.data.fd = w->inotify;
+  if (epoll_ctl(w->epoll, EPOLL_CTL_ADD, w->inotify, &ev) != 0) {
+    perror("ini_watcher_new: epoll_ctl");
+    goto fail;
+  }
+  ev.data.fd = w->stop;
+  if (epoll_ctl(w->epoll, EPOLL_CTL_ADD, w->stop, &ev) != 0) {
+    perror("ini_watcher_new: epoll_ctl");
+    goto fail;
   }
 
-  if (val != NULL) {
-    pair->val = strdup(val);
+  if (pthread_mutex_init(&w->lock, NULL) != 0) {
+    fprintf(stderr, "ini_watcher_new: pthread_mutex_init failed\n");
+    goto fail;
+  }
+  if (pthread_create(&w->thread, NULL, watch_thread, w) != 0) {
+    fprintf(stderr, "ini_watcher_new: pthread_create failed\n");
+    pthread_mutex_destroy(&w->lock);
+    goto fail;
   }
+  return w;
 
-  return pair->val;
+fail:
+  if (w->inotify >= 0) {
+    close(w->inotify);
+  }
+  if (w->epoll >= 0) {
+    close(w->epoll);
+  }
+  if (w->stop >= 0) {
+    close(w->stop);
+  }
+  free(w);
+  return NULL;
 }
 
-struct inipair* ini_put(struct inifile* ini, char* section, char* key,
-                        char* val) {
-  if (ini == NULL || key == NULL) {
-    return NULL;
+int ini_watcher_add(struct iniwatcher* w, char* filename, int flags,
+                    ini_watch_op cb, void* userdata) {
+  if (w == NULL || filename == NULL || cb == NULL) {
+    return 1;
   }
 
-  struct inisection* s = ini_getsection(ini, section);
-  if (s == NULL) {
-    s = section_insert(ini, makesection(section));
-    if (s == NULL) {
-      return NULL;
-    }
+  struct iniwatch* iw = calloc(1, sizeof(struct iniwatch));
+  if (iw == NULL || (iw->filename = strdup(filename)) == NULL) {
+    perror("ini_watcher_add: calloc");
+    free(iw);
+    return 1;
   }
 
-  struct inipair* p = inisection_getpair(s, key);
-  if (p == NULL) {
-    p = pair_insert(s, makepair(key, val));
-    if (p == NULL) {
-      return NULL;
-    }
+  char* slash = strrchr(iw->filename, '/');
+  iw->base = slash == NULL ? iw->filename : slash + 1;
+  char* dir;
+  if (slash == NULL) {
+    dir = strdup(".");
+  } else if (slash == iw->filename) {
+    dir = strdup("/");
+  } else {
+    dir = strndup(iw->filename, slash - iw->filename);
   }
-
-  return p;
-}
-
-struct inipair* ini_set(struct inifile* ini, char* section, char* key,
-                        char* val) {
-  if (ini == NULL || key == NULL) {
-    return NULL;
+  if (dir == NULL) {
+    perror("ini_watcher_add: strdup");
+    free(iw->filename);
+    free(iw);
+    return 1;
   }
 
-  struct inisection* s = ini_getsection(ini, section);
-  if (s == NULL) {
-    return NULL;
+  // watching a directory twice gives back the same descriptor
+  iw->wd = inotify_add_watch(w->inotify, dir, WATCH_MASK);
+  free(dir);
+  if (iw->wd < 0) {
+    perror("ini_watcher_add: inotify_add_watch");
+    free(iw->filename);
+    free(iw);
+    return 1;
   }
+  // a mapped file would have to stay unchanged for as long as the callback
+  // keeps what was loaded from it, which is the opposite of why it's watched
+  iw->flags = flags & ~INIO_MMAP;
+  iw->cb = cb;
+  iw->userdata = userdata;
 
-  struct inipair* p = inisection_getpair(s, key);
-  if (p == NULL) {
-    return NULL;
+  pthread_mutex_lock(&w->lock);
+  iw->next = w->watches;
+  w->watches = iw;
+  pthread_mutex_unlock(&w->lock);
+  return 0;
+}
+
+void ini_watcher_free(struct iniwatcher* w) {
+  if (w == NULL) {
+    return;
   }
 
-  if (NULL == pair_setval(p, val)) {
-    return NULL;
+  uint64_t one = 1;
+  if (write(w->stop, &one, sizeof(one)) != sizeof(one)) {
+    perror("ini_watcher_free: write");
   }
+  pthread_join(w->thread, NULL);
 
-  return p;
+  while (w->watches != NULL) {
+    struct iniwatch* next = w->watches->next;
+    free(w->watches->filename);
+    free(w->watches);
+    w->watches = next;
+  }
+  pthread_mutex_destroy(&w->lock);
+  close(w->inotify);
+  close(w->epoll);
+  close(w->stop);
+  free(w);
 }
+
+#endif // __linux__
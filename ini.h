@@ -22,6 +22,9 @@
 #ifndef INI_H_
 #define INI_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 /*
  * Options for INI files. By default, options are assumed off.
  */
@@ -34,6 +37,57 @@ enum INI_OPT {
   INIO_ALLOW_EMPTY = 1 << 1,
   // allow all options
   INIO_ALL = 0xFF,
+
+  // The following change how a file is stored rather than how it is parsed,
+  // and are not included in INIO_ALL.
+
+  // allocate sections and pairs loaded from files, and the indexes over
+  // them, out of an arena owned by the inifile, so they are released all at
+  // once by freeini() without walking the file
+  INIO_ARENA = 1 << 8,
+  // load files by mapping them into memory and pointing keys and values
+  // straight into the mapping rather than copying them; the mapping lives
+  // until freeini(), and the file must not be modified or truncated until
+  // then either, since what isn't copied still reads from the file (replace
+  // it by renaming a new file over it instead)
+  INIO_MMAP = 1 << 9,
+  // keep one copy of each distinct key and section name in the file, shared
+  // by everything using it, rather than one per pair (see ini_intern())
+  INIO_INTERN = 1 << 10,
+};
+
+/*
+ * Slot in an iniindex. The hash is kept alongside the item so that
+ * probing and resizing never have to touch the item itself.
+ */
+struct inislot {
+  unsigned long hash;
+  void* item;
+};
+
+/*
+ * Open-addressing hash index used internally to speed up lookups by name.
+ * The linked lists remain the canonical storage and iteration order; the
+ * index only points into them. You should not touch this.
+ */
+struct iniindex {
+  struct inislot* slots;
+  // number of slots, always either 0 or a power of two
+  size_t cap;
+  // number of occupied slots
+  size_t count;
+  // nonzero if the slots are from an inifile's arena rather than malloc
+  int arena;
+};
+
+/*
+ * Value of a pair as parsed by one of the ini_get_*() functions.
+ * You should not touch this.
+ */
+union inivalue {
+  int64_t i;
+  uint64_t u;
+  double d;
 };
 
 /*
@@ -46,6 +100,20 @@ struct inipair {
   struct inipair* next;
   char* key;
   char* val;
+  // memory in this pair owned by something other than malloc, internal use
+  unsigned int borrowed;
+  // hash and length of the key, set by pair_insert(), internal use
+  unsigned long hash;
+  size_t keylen;
+  // section the pair is in, set by pair_insert(), internal use
+  struct inisection* section;
+  // the value as last parsed by one of the ini_get_*() functions, and which
+  // one it was parsed by, internal use
+  unsigned int valtype;
+  union inivalue parsed;
+  // children in the section's search tree, internal use
+  struct inipair* left;
+  struct inipair* right;
 };
 
 /*
@@ -55,6 +123,33 @@ struct inisection {
   char* name;
   struct inipair* head;
   struct inisection* next;
+  // last pair in the list, so in-order inserts don't walk the list
+  struct inipair* tail;
+  // hash index of the pairs in the list, keyed by key
+  struct iniindex pairs;
+  // search tree over the pairs, which keeps inserts from walking the list
+  // once keys stop showing up in order, internal use
+  struct inipair* root;
+  // memory in this section owned by something other than malloc, internal use
+  unsigned int borrowed;
+  // hash and length of the name, set by section_insert(), internal use
+  unsigned long hash;
+  size_t namelen;
+  // changes whenever a pair is added or replaced, internal use
+  unsigned long generation;
+  // file the section is in, set by section_insert(), internal use
+  struct inifile* file;
+  // children in the file's search tree, internal use
+  struct inisection* left;
+  struct inisection* right;
+};
+
+/*
+ * Bump allocator used for INIO_ARENA. You should not touch this.
+ */
+struct iniarena {
+  // list of blocks, most recently allocated first
+  struct iniarenablock* blocks;
 };
 
 /*
@@ -69,12 +164,139 @@ struct inisection {
 struct inifile {
   // head of the list of sections, kept in alphabetical
   struct inisection* head;
+  // last section in the list, so in-order inserts don't walk the list
+  struct inisection* tail;
+  // hash index of the sections in the list, keyed by name
+  struct iniindex sections;
+  // search tree over the sections, which keeps inserts from walking the
+  // list once names stop showing up in order, internal use
+  struct inisection* root;
   // default section (options found before the first section)
   struct inisection* default_section;
   // flags determining parsing behavior (see enum INI_OPT)
   int flags;
+  // arena which sections and pairs are allocated from with INIO_ARENA
+  struct iniarena arena;
+  // files mapped with INIO_MMAP, internal use
+  struct inimapping* mappings;
+  // strings interned with ini_intern() or INIO_INTERN, internal use
+  struct iniindex strings;
+  // changes whenever a section is added, internal use
+  unsigned long generation;
+  // subscriptions made with ini_subscribe(), internal use
+  struct inisubs* subs;
+  // pairs replaced while loading, kept by loadinifromfile_parallel() so the
+  // changes can be reported later, internal use
+  struct inireplaced* replaced;
+  // nonzero once anything in the file may own memory from malloc, which
+  // freeini() then has to walk the file to find, internal use
+  int heapowned;
+};
+
+/*
+ * Section name or key which has been hashed ahead of time, for lookups done
+ * often enough that hashing the name every time matters. Make these with
+ * ini_makekey(), and don't modify them afterwards. The string is not copied,
+ * so it must outlive the key.
+ */
+struct inikey {
+  const char* str;
+  size_t len;
+  unsigned long hash;
+};
+
+/*
+ * Types of field ini_bind() can fill in, and the C type of each.
+ */
+enum INI_TYPE {
+  // char*, pointing at the pair's value rather than a copy of it, which
+  // is NULL for keys without a value
+  INIV_STRING,
+  // int64_t, as from ini_get_int64()
+  INIV_INT64,
+  // double, as from ini_get_double()
+  INIV_DOUBLE,
+  // int, as from ini_get_bool()
+  INIV_BOOL,
+  // int64_t, as from ini_get_duration_ns()
+  INIV_DURATION_NS,
+  // uint64_t, as from ini_get_size_bytes()
+  INIV_SIZE_BYTES,
+};
+
+/*
+ * Result of binding a single field with ini_bind().
+ */
+enum INI_BIND {
+  // the field was filled in
+  INIB_OK = 0,
+  // the key doesn't exist
+  INIB_MISSING,
+  // the key has no value or its value couldn't be parsed as the field's type
+  INIB_INVALID,
+};
+
+/*
+ * Describes a field of a structure for ini_bind() to fill in from the given
+ * key in the given section (NULL meaning the default section). offset is
+ * where the field is in the structure, as given by offsetof().
+ */
+struct inifield {
+  char* section;
+  char* key;
+  enum INI_TYPE type;
+  size_t offset;
 };
 
+/*
+ * Kinds of change ini_reload_incremental() can make to a pair.
+ */
+enum INI_CHANGE {
+  // the pair is new
+  INIC_ADDED,
+  // the pair's value changed
+  INIC_CHANGED,
+  // the pair is gone
+  INIC_REMOVED,
+};
+
+/*
+ * A change made by ini_reload_incremental().
+ */
+struct inichange {
+  enum INI_CHANGE kind;
+  // copies of the pair's section name (NULL for the default section) and key
+  char* section;
+  char* key;
+  // the pair, or NULL if it was removed
+  struct inipair* pair;
+};
+
+/*
+ * Every change made by ini_reload_incremental(), in the same order as the
+ * file. Free it with ini_changeset_free().
+ */
+struct inichangeset {
+  struct inichange* changes;
+  size_t count;
+  // space allocated for changes, internal use
+  size_t cap;
+};
+
+/*
+ * Callback used by ini_subscribe(), given the section and pair which changed,
+ * how it changed, and the userdata passed to ini_subscribe(). Pairs which
+ * are being removed are passed before they're freed.
+ */
+typedef void (*ini_change_op)(struct inisection*, struct inipair*,
+                              enum INI_CHANGE, void*);
+
+/*
+ * Subscription made with ini_subscribe(). You should not touch the contents
+ * of this.
+ */
+struct inisub;
+
 /*
  * Callback function used when you call parseini().
  * The arguments are the INI section in which the pair was found
@@ -84,6 +306,43 @@ struct inifile {
  */
 typedef void(*ini_pair_op)(struct inisection*, struct inipair*);
 
+/*
+ * Like ini_pair_op, but with a pointer passed through from the caller,
+ * and a return value: 0 to carry on, or anything else to stop (in which case
+ * that value is returned by whichever function was calling back).
+ */
+typedef int(*ini_pair_op_ex)(struct inisection*, struct inipair*, void*);
+
+/*
+ * Read-only copy of an INI file packed into a single block of memory.
+ * See ini_freeze().
+ */
+struct inifrozen;
+
+/*
+ * Handle to a key in an INI file, made with ini_path_compile(). You should
+ * not touch the contents of this.
+ */
+struct inipath;
+
+/*
+ * Incremental parser, for INI data which arrives in pieces.
+ * See ini_parser_new().
+ */
+struct iniparser;
+
+/*
+ * Handle which lets files be replaced while other threads are reading them,
+ * made with ini_handle_new(). You should not touch the contents of this.
+ */
+struct inihandle;
+
+/*
+ * A reading thread's registration with an inihandle, made with
+ * ini_handle_reader(). You should not touch the contents of this.
+ */
+struct inireader;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -108,10 +367,83 @@ extern struct inifile* newinifromfile(char* filename, int flags);
  * presumably created by makeini() or newinifromfile().
  * If inif contains values already, they will be kept.
  * Duplicate values will be overwritten.
+ * Lines which can't be parsed are skipped, including a section header with
+ * no closing ']', so the pairs after one stay in the section before it.
  * Returns 0 on success, else 1.
  */
 extern int loadinifromfile(struct inifile* inif, char* filename);
 
+/*
+ * Like newinifromfile(), but parses large files on several threads.
+ * See loadinifromfile_parallel().
+ */
+extern struct inifile* newinifromfile_parallel(char* filename, int flags,
+                                               int nthreads);
+
+/*
+ * Like loadinifromfile(), but maps the file and splits it at section headers
+ * into pieces of at least a megabyte, which are parsed on up to nthreads
+ * threads (one per online CPU if nthreads is less than 1) and merged back in
+ * order, so duplicate keys are overwritten exactly as they would be by
+ * loadinifromfile(). Subscribers (see ini_subscribe()) are told about every
+ * pair added or replaced, as with loadinifromfile(), though changes to
+ * different keys may be reported in a different order. Files too small to
+ * split are parsed on the calling thread. The file must not be truncated
+ * while it's loading; with INIO_MMAP, every piece borrows from the one
+ * mapping, so as with loadinifromfile() it must not be modified or truncated
+ * until inif is freed either.
+ * Returns 0 on success, else 1.
+ */
+extern int loadinifromfile_parallel(struct inifile* inif, char* filename,
+                                    int nthreads);
+
+/*
+ * Parse len bytes of INI data from memory into a new inifile structure.
+ * Data must not be NULL, but does not need to be NUL-terminated. Flags should
+ * be set from enum INI_OPT (INIO_MMAP has no effect here).
+ * Returns NULL on error, else returns a pointer to the
+ * parsed INI file structure.
+ */
+extern struct inifile* newinifrombuffer(const char* data, size_t len,
+                                        int flags);
+
+/*
+ * Load len bytes of INI data from memory into an existing inifile structure,
+ * the same way loadinifromfile() loads a file. Everything kept from the data
+ * is copied, so it may be freed or reused once this returns.
+ * Returns 0 on success, else 1.
+ */
+extern int loadinifrombuffer(struct inifile* inif, const char* data,
+                             size_t len);
+
+/*
+ * Make a new incremental parser, which is fed data with ini_parser_feed()
+ * and finished off with ini_parser_finish().
+ * If ini is not NULL, data is loaded into it the same way loadinifromfile()
+ * would, and flags is ignored in favor of ini's. If cb is not NULL, it is
+ * called with each pair as soon as the line containing it is complete.
+ * If ini is NULL, nothing is kept: the section and pair passed to cb only last
+ * until it returns, and memory use is bounded by the longest line rather than
+ * the size of the data. At least one of ini and cb must be given.
+ * Returns NULL on error.
+ */
+extern struct iniparser* ini_parser_new(struct inifile* ini, ini_pair_op cb,
+                                        int flags);
+
+/*
+ * Feed the next len bytes of data to a parser. Lines may be split across
+ * any number of calls.
+ * Returns 0 on success, else 1.
+ */
+extern int ini_parser_feed(struct iniparser* p, const char* chunk, size_t len);
+
+/*
+ * Parse whatever is left of the data fed to a parser (i.e. a last line with no
+ * newline), and free the parser.
+ * Returns 0 on success, else 1.
+ */
+extern int ini_parser_finish(struct iniparser* p);
+
 /*
  * Writes an INI file structures contents to the disk.
  * Returns 0 on success, 1 on failure.
@@ -124,10 +456,31 @@ extern int writeinitofile(struct inifile* ini, char* filename);
  * Parse an INI file. Every key-value pair is passed to the callback function,
  * along with its section. This callback function will be called repeatedly
  * until all pairs in the file have been parsed. This is effectively
- * a wrapper around ini_foreach with a less general name.
+ * a wrapper around ini_foreach with a less general name, and needs the file
+ * to have been loaded already; see ini_parse_stream() to parse in one pass.
  */
 extern void parseini(struct inifile* ini, ini_pair_op cb);
 
+/*
+ * Parse an INI file in a single pass without loading it into an inifile
+ * structure. As each section header is found, cb is called with that section
+ * and a NULL pair, and then with each pair in the section as it's found
+ * (pairs before the first section are in a section with a NULL name).
+ * Pairs are in file order, including any duplicates. The section and pair
+ * passed to cb only last until it returns, and nothing is allocated per pair.
+ * Flags should be set from enum INI_OPT. Userdata is passed along to cb.
+ * Returns 0 once the whole file is parsed, 1 on error, or the value cb
+ * returned if it asked to stop.
+ */
+extern int ini_parse_stream(char* filename, int flags, ini_pair_op_ex cb,
+                            void* userdata);
+
+/*
+ * Like ini_parse_stream(), but parses len bytes of data from memory.
+ */
+extern int ini_parse_stream_buffer(const char* data, size_t len, int flags,
+                                   ini_pair_op_ex cb, void* userdata);
+
 /*
  * Loops through all sections and pairs in an INI file and performs
  * the given operation on them. Note that the default section's
@@ -135,6 +488,15 @@ extern void parseini(struct inifile* ini, ini_pair_op cb);
  */
 extern void ini_foreach(struct inifile* ini, ini_pair_op cb);
 
+/*
+ * Like ini_foreach(), but userdata is passed along to the callback, and
+ * the loop stops as soon as the callback returns nonzero.
+ * Returns whatever the callback returned to stop the loop, or 0 if it
+ * went through every pair.
+ */
+extern int ini_foreach_ex(struct inifile* ini, ini_pair_op_ex cb,
+                          void* userdata);
+
 /*
  * Returns the section in an INI file with the given name.
  * If name is NULL, the default section is returned. If the
@@ -160,6 +522,120 @@ extern struct inipair* inisection_getpair(struct inisection* section,
 extern struct inipair* ini_getpair(struct inifile* ini, char* section,
                                    char* key);
 
+/*
+ * Hashes a section name or key for use with the *_key() lookups below.
+ * A NULL str makes a key naming the default section.
+ */
+extern struct inikey ini_makekey(const char* str);
+
+/*
+ * Like ini_getsection(), but with a name from ini_makekey().
+ */
+extern struct inisection* ini_getsection_key(struct inifile* ini,
+                                             const struct inikey* name);
+
+/*
+ * Like inisection_getpair(), but with a key from ini_makekey().
+ */
+extern struct inipair* inisection_getpair_key(struct inisection* section,
+                                              const struct inikey* key);
+
+/*
+ * Like ini_getpair(), but with names from ini_makekey(). If section is NULL,
+ * the default section is searched.
+ */
+extern struct inipair* ini_getpair_key(struct inifile* ini,
+                                       const struct inikey* section,
+                                       const struct inikey* key);
+
+/*
+ * The following functions look up the given key in the given section (NULL
+ * meaning the default section) with ini_getpair() and parse its value as a
+ * particular type. The parsed value is remembered in the pair until its value
+ * is changed, so reading it again doesn't parse it again. Since that means
+ * they modify the pair, they must not be called on the same file from more
+ * than one thread at a time.
+ * They return 0 and store the value in *out on success, or return 1 and leave
+ * *out alone if the key doesn't exist, has no value, or can't be parsed.
+ */
+
+/*
+ * Parses a value as a decimal integer, or a hexadecimal one with a leading
+ * 0x, with an optional sign.
+ */
+extern int ini_get_int64(struct inifile* ini, char* section, char* key,
+                         int64_t* out);
+
+/*
+ * Parses a value as a floating-point number, as strtod() does.
+ */
+extern int ini_get_double(struct inifile* ini, char* section, char* key,
+                          double* out);
+
+/*
+ * Parses a value as a boolean, storing 1 for true, yes, on or 1 and 0 for
+ * false, no, off or 0, ignoring case.
+ */
+extern int ini_get_bool(struct inifile* ini, char* section, char* key,
+                        int* out);
+
+/*
+ * Parses a value as a duration, in nanoseconds. Durations are an optional
+ * sign followed by one or more numbers, each of which may have a fraction
+ * and must have a unit, out of ns, us, ms, s, m, h and d; for example
+ * "250ms", "1.5s" or "1h30m". A plain 0 is also allowed.
+ */
+extern int ini_get_duration_ns(struct inifile* ini, char* section, char* key,
+                               int64_t* out);
+
+/*
+ * Parses a value as a size, in bytes. Sizes are a number, which may have a
+ * fraction, followed by an optional unit, ignoring case: B for bytes; K, M, G
+ * or T, optionally followed by iB, for powers of 1024; or KB, MB, GB or TB for
+ * powers of 1000. For example, "4096", "64K", "1.5GiB" or "10MB".
+ */
+extern int ini_get_size_bytes(struct inifile* ini, char* section, char* key,
+                              uint64_t* out);
+
+/*
+ * Fills in the fields of the structure at dest described by an array of
+ * nfields fields, parsing each value as ini_get_*() does for its type. This
+ * visits each section once and walks the fields in the same order as the
+ * keys, rather than looking each one up on its own. Fields which can't be
+ * filled in are left alone. If status is not NULL, it must point to an array
+ * of nfields, which is filled in with the result of each field (see
+ * enum INI_BIND). Like the ini_get_*() functions, this remembers parsed
+ * values in the pairs they came from.
+ * Returns the number of fields which couldn't be filled in, or -1 on error.
+ */
+extern long ini_bind(struct inifile* ini, const struct inifield* fields,
+                     size_t nfields, void* dest, enum INI_BIND* status);
+
+/*
+ * Makes a handle for the given key in the given section (NULL meaning the
+ * default section) which ini_path_get() can look up much faster than
+ * ini_getpair() can, for keys which are looked up over and over. The names
+ * are copied, and neither the section nor the key needs to exist yet.
+ * The handle must not outlive the file, and must be freed with
+ * ini_path_free(). Returns NULL on error.
+ */
+extern struct inipath* ini_path_compile(struct inifile* ini, char* section,
+                                        char* key);
+
+/*
+ * Returns the pair a handle from ini_path_compile() refers to, or NULL if it
+ * doesn't exist. The pair is found once and remembered until the file's
+ * structure changes (such as pairs in the section being added or replaced),
+ * so changing values with pair_setval(), ini_put() or ini_set() does not
+ * cause the pair to be looked up again.
+ */
+extern struct inipair* ini_path_get(struct inipath* path);
+
+/*
+ * Frees a handle from ini_path_compile().
+ */
+extern void ini_path_free(struct inipath* path);
+
 /*
  * Sets the value of a key-value pair. This is the only recommended way
  * to set the value of a pair, as it deals with string duplication for you.
@@ -183,6 +659,53 @@ extern struct inipair* ini_put(struct inifile* ini, char* section, char* key,
 extern struct inipair* ini_set(struct inifile* ini, char* section, char* key,
                                char* val);
 
+/*
+ * Loads a new version of a file into an existing inifile, changing only what
+ * differs between them: pairs with new values are changed in place with
+ * pair_setval(), new pairs and sections are added, and pairs and sections
+ * which are gone are removed and freed. Pairs which didn't change are left
+ * alone, so pointers to them stay valid, and so do pointers to the other
+ * pairs except for those which were removed. The file must not be in an
+ * inihandle, since this changes it in place, and must not have been loaded
+ * with INIO_MMAP, since it would be borrowing from the file being changed.
+ * With INIO_ARENA, pairs and sections added here come from malloc and are
+ * freed when later removed, but those loaded into the arena to begin with
+ * only go when the whole file is freed.
+ * Returns the set of changes, which is empty if nothing changed, or NULL on
+ * error. If an error happens after changes have started, the file may be
+ * left partly updated.
+ */
+extern struct inichangeset* ini_reload_incremental(struct inifile* ini,
+                                                   char* filename);
+
+/*
+ * Frees a set of changes from ini_reload_incremental().
+ */
+extern void ini_changeset_free(struct inichangeset* cs);
+
+/*
+ * Calls cb whenever a pair with the given key in the given section (NULL
+ * meaning the default section) is added, has its value set, or is removed.
+ * If key ends in '*', the subscription is instead to every key starting with
+ * what comes before the '*', so "*" alone covers the whole section.
+ * Changes are reported by pair_setval() (and so ini_put() and ini_set()),
+ * pair_insert(), and anything that loads or reloads the file, including
+ * ini_reload_incremental(). Finding the subscriptions for a change takes the
+ * same time however many subscriptions there are to other keys.
+ * Callbacks may unsubscribe themselves, but must not otherwise subscribe or
+ * unsubscribe while changes are being reported.
+ * Returns the subscription, which lasts until ini_unsubscribe() or freeini(),
+ * or NULL on error.
+ */
+extern struct inisub* ini_subscribe(struct inifile* ini, char* section,
+                                    char* key, ini_change_op cb,
+                                    void* userdata);
+
+/*
+ * Cancels and frees a subscription made with ini_subscribe().
+ */
+extern void ini_unsubscribe(struct inifile* ini, struct inisub* sub);
+
 /*
  * Frees an entire INI file structure.
  */
@@ -212,6 +735,9 @@ extern struct inipair* makepair(char* key, char* val);
 /*
  * Frees a pair and returns a pointer to the next pair in the list,
  * or returns NULL if there isn't one.
+ * This does not unlink the pair from its section, so it should only be used
+ * on pairs which were never inserted (pair_insert() and freesection() take
+ * care of the rest).
  */
 extern struct inipair* freepair(struct inipair* pair);
 
@@ -235,6 +761,254 @@ extern struct inisection* section_insert(struct inifile* file,
 extern struct inipair* pair_insert(struct inisection* sec,
                                    struct inipair* pair);
 
+/*
+ * Compile an INI file structure into a frozen, read-only copy: one
+ * contiguous block holding a sorted section table, a sorted table of pairs
+ * for each section and all of the strings, which are found by binary search.
+ * Later changes to ini are not reflected in the copy, and ini may be freed.
+ * Returns NULL on error.
+ */
+extern struct inifrozen* ini_freeze(struct inifile* ini);
+
+/*
+ * Returns the value of the given key in the given section of a frozen file
+ * (NULL section implies default section), or NULL if it is not found or has
+ * no value. The string lasts as long as the frozen file.
+ */
+extern const char* ini_frozen_get(const struct inifrozen* fz,
+                                  const char* section, const char* key);
+
+/*
+ * Returns 1 if the given key exists in the given section of a frozen file,
+ * whether or not it has a value, else 0.
+ */
+extern int ini_frozen_has(const struct inifrozen* fz, const char* section,
+                          const char* key);
+
+/*
+ * Loops through all pairs in a frozen file in the same order as
+ * ini_foreach_ex(), with the same handling of userdata and return values.
+ * The section and pair passed to cb only last until it returns, and must not
+ * be modified. Returns 1 if fz or cb is NULL.
+ */
+extern int ini_frozen_foreach(const struct inifrozen* fz, ini_pair_op_ex cb,
+                              void* userdata);
+
+/*
+ * Frees a frozen file, or unmaps it if it came from ini_open_binary() or
+ * ini_frozen_attach().
+ */
+extern void ini_frozen_free(struct inifrozen* fz);
+
+/*
+ * Writes a frozen copy of an INI file structure to the disk in binary form,
+ * which ini_open_binary() can use without parsing it. This is the same as
+ * ini_freeze() followed by ini_frozen_write().
+ * Returns 0 on success, 1 on failure.
+ */
+extern int ini_write_binary(struct inifile* ini, char* filename);
+
+/*
+ * Writes a frozen file to the disk in binary form. The data is written to a
+ * temporary file next to filename, synced, and then renamed over it, so
+ * processes which have the old file open keep seeing it intact. The new file
+ * keeps the old one's permissions, or gets the usual ones for a new file.
+ * The format is versioned, and only readable on machines with the same byte
+ * order as the one which wrote it.
+ * Returns 0 on success, 1 on failure.
+ */
+extern int ini_frozen_write(const struct inifrozen* fz, char* filename);
+
+/*
+ * Maps a file written by ini_write_binary() or ini_frozen_write() and
+ * returns it as a frozen file, which is queried in place with no parsing or
+ * copying. The file is checked to make sure it's safe to use first.
+ * Returns NULL on error, or if the file is not in a supported format.
+ */
+extern struct inifrozen* ini_open_binary(char* filename);
+
+/*
+ * Publishes a copy of a frozen file in a POSIX shared memory object with the
+ * given name (as for shm_open(), e.g. "/myconfig"), so that any number of
+ * processes can use the one copy through ini_frozen_attach(). Publishing
+ * over an existing name replaces it for new attachers, while anyone already
+ * attached keeps the old image until they free it. The object gets the mode
+ * a new file would (0666 less the umask), so set the umask to choose who can
+ * attach. Some systems need -lrt for this.
+ * Returns 0 on success, 1 on failure.
+ */
+extern int ini_frozen_publish(const struct inifrozen* fz, const char* name);
+
+/*
+ * Maps a frozen file published with ini_frozen_publish() read-only. This
+ * takes about as long as the mapping itself, as nothing is copied or parsed.
+ * Free it with ini_frozen_free() as usual.
+ * Returns NULL on error, or if there is no valid image under that name.
+ */
+extern struct inifrozen* ini_frozen_attach(const char* name);
+
+/*
+ * Removes a published frozen file's name. Processes which are attached to
+ * it keep it until they free it.
+ * Returns 0 on success, 1 on failure.
+ */
+extern int ini_frozen_unpublish(const char* name);
+
+/*
+ * Makes a new, modifiable INI file structure from a frozen one, with the
+ * given flags. Together with writeinitofile(), this turns a binary file back
+ * into text.
+ * Returns NULL on error.
+ */
+extern struct inifile* ini_thaw(const struct inifrozen* fz, int flags);
+
+/*
+ * Returns the file's interned copy of str, adding one if there isn't one yet.
+ * The copy belongs to the file and lives until freeini(), so it must not be
+ * modified or freed. With INIO_INTERN, every key and section name in the
+ * file is interned, so passing interned strings to lookups such as
+ * inisection_getpair() lets them match names by pointer instead of
+ * comparing them. Returns NULL on error.
+ */
+extern char* ini_intern(struct inifile* ini, char* str);
+
+/*
+ * Generates a C header with a minimal perfect hash over every section and key
+ * in an INI file, for configs whose set of names is fixed ahead of time.
+ * Every identifier in the header starts with prefix (or its upper case form),
+ * which must be a valid C identifier. The header provides:
+ *  - PREFIX_COUNT, the number of section/key names, each of which has a slot
+ *  - an enum naming every slot, as PREFIX_SECTION__KEY or PREFIX_KEY for the
+ *    default section, with anything that isn't a letter or digit made into
+ *    an underscore; names which clash with each other, PREFIX_COUNT or the
+ *    include guard PREFIX_PHASH_H_ get _n added, n being the slot (and then
+ *    _k as well, in the rare case that is taken too)
+ *  - prefix_index(section, key), which returns a name's slot, or -1 if it is
+ *    not one of them, with a single hash and compare
+ *  - prefix_bind(ini, slots), which fills an array of PREFIX_COUNT pair
+ *    pointers from any inifile, so later lookups are just array indexing
+ * Returns 0 on success, 1 on failure.
+ */
+extern int ini_write_phash(struct inifile* ini, char* filename, char* prefix);
+
+/*
+ * The ini_handle_*() and ini_reader_*() functions let a file be reloaded
+ * while other threads are reading it. Readers never wait for anything: each
+ * reading thread registers once, then brackets its reads with
+ * ini_reader_lock() and ini_reader_unlock(), which get the current file with
+ * a single atomic load. Writers publish a new file by swapping it in, and the
+ * file it replaced is freed once every reader that might still be using it
+ * has unlocked.
+ * Files in a handle must be treated as read-only, which also rules out the
+ * ini_get_*() functions, ini_bind() and ini_path_get(), since they update the
+ * pairs they read. These functions require pthreads, and use GCC's __atomic
+ * builtins, so ini.c must be built with GCC or clang.
+ */
+
+/*
+ * Makes a handle for a file, which the handle takes ownership of.
+ * Returns NULL on error.
+ */
+extern struct inihandle* ini_handle_new(struct inifile* ini);
+
+/*
+ * Registers the calling thread as a reader of a handle. Each thread which
+ * reads from the handle needs its own reader.
+ * Returns NULL on error.
+ */
+extern struct inireader* ini_handle_reader(struct inihandle* h);
+
+/*
+ * Returns the handle's current file, which stays valid until the matching
+ * ini_reader_unlock(), however many times it is replaced in the meantime.
+ * A reader must be unlocked before it is locked again.
+ */
+extern struct inifile* ini_reader_lock(struct inireader* r);
+
+/*
+ * Stops using the file returned by the last ini_reader_lock().
+ */
+extern void ini_reader_unlock(struct inireader* r);
+
+/*
+ * Unregisters and frees a reader, which must not be locked.
+ */
+extern void ini_reader_free(struct inireader* r);
+
+/*
+ * Replaces the handle's file with ini, which the handle takes ownership of.
+ * The old file is freed once no reader can be using it, either here or by a
+ * later call to ini_handle_publish() or ini_handle_reclaim().
+ * Returns 0 on success, 1 on failure.
+ */
+extern int ini_handle_publish(struct inihandle* h, struct inifile* ini);
+
+/*
+ * Loads a file with newinifromfile() and publishes it to the handle. The
+ * file is loaded without holding up readers or other writers.
+ * Returns 0 on success, 1 on failure, in which case the handle's file is
+ * left as it was.
+ */
+extern int ini_handle_reload(struct inihandle* h, char* filename, int flags);
+
+/*
+ * Frees any replaced files which readers have finished with.
+ */
+extern void ini_handle_reclaim(struct inihandle* h);
+
+/*
+ * Frees a handle along with its file, any replaced files and any readers
+ * still registered with it. No readers may be locked.
+ */
+extern void ini_handle_free(struct inihandle* h);
+
+#ifdef __linux__
+/*
+ * Watches INI files with inotify from a single background thread, made with
+ * ini_watcher_new(). You should not touch the contents of this.
+ */
+struct iniwatcher;
+
+/*
+ * Callback used by ini_watcher_add(), given the name of a file which changed
+ * as it was passed to ini_watcher_add(), the newly loaded file, and the
+ * userdata passed to ini_watcher_add(). The callback owns the new file, and
+ * could, for example, give it to ini_handle_publish(). Callbacks are called
+ * from the watcher's thread, one at a time.
+ */
+typedef void (*ini_watch_op)(const char* filename, struct inifile* ini,
+                             void* userdata);
+
+/*
+ * Makes a watcher and starts its thread. Once a watched file changes, the
+ * watcher waits until debounce_ms milliseconds have gone by without it
+ * changing again before loading it, so that a burst of writes to the file
+ * only loads it once.
+ * Returns NULL on error.
+ */
+extern struct iniwatcher* ini_watcher_new(int debounce_ms);
+
+/*
+ * Starts watching a file, which is loaded with newinifromfile() using the
+ * given flags whenever it changes, and given to cb. The file's directory is
+ * watched rather than the file itself, so that files which are replaced
+ * (such as by renaming a new file over them, as many editors do) are
+ * followed, and so the file need not exist yet. Changes which leave the
+ * file unloadable, such as deleting it, are ignored. INIO_MMAP is dropped
+ * from flags, since a watched file is expected to change while the files
+ * loaded from it are still in use.
+ * Returns 0 on success, 1 on failure.
+ */
+extern int ini_watcher_add(struct iniwatcher* w, char* filename, int flags,
+                           ini_watch_op cb, void* userdata);
+
+/*
+ * Stops a watcher's thread, waiting for any callback in progress to return,
+ * and frees it.
+ */
+extern void ini_watcher_free(struct iniwatcher* w);
+#endif // __linux__
+
 #ifdef __cplusplus
 }
 #endif